@@ -1,10 +1,17 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <float.h>
 #include <stdio.h>
 #include <math.h>
 #include <unistd.h>
 #include <string.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
 #include <mpi.h>
 
 enum log_level
@@ -17,6 +24,266 @@ enum log_level
     LOG_NONE = 5
 };
 
+/// @brief The ways of exchanging the ghost rings of the blocks.
+enum halo_method
+{
+    /// Two-sided messages set up every iteration
+    HALO_SENDRECV = 0,
+    /// Two-sided messages set up once as persistent requests
+    HALO_PERSISTENT = 1,
+    /// Plain loads from the memory of neighbours on the same node, with
+    /// two-sided messages to the others
+    HALO_SHARED = 2,
+    /// One-sided puts into the ghost rings of the neighbours, in epochs
+    /// opened and closed by fences
+    HALO_RMA_FENCE = 3,
+    /// One-sided puts in post-start-complete-wait epochs between neighbours
+    HALO_RMA_PSCW = 4,
+    /// One neighbourhood collective over a graph of the neighbours
+    HALO_NEIGHBOUR = 5
+};
+
+/// @brief The encodings of the ghost cells sent by the two-sided exchange.
+enum halo_codec
+{
+    /// The exact doubles
+    HALO_CODEC_NONE = 0,
+    /// Each cell rounded to a float
+    HALO_CODEC_FLOAT = 1,
+    /// Each cell rounded to one of 65536 levels between the smallest and
+    /// largest cell of the message
+    HALO_CODEC_QUANTIZE = 2
+};
+
+/// How many times the precision the largest change has to stay above for the
+/// ghost cells to keep being encoded, so the exact sweeps decide convergence
+#define HALO_CODEC_MARGIN 10
+
+/// How many times the resolution of a halo codec the largest change has to
+/// stay above for the ghost cells to keep being encoded, so the error of the
+/// codec never holds up the solve
+#define HALO_CODEC_NOISE 16
+
+/// @brief The worker threads relaxing the block of one process together.
+typedef struct thread_pool thread_pool;
+
+/// @brief The settings of a solve, shared by every process.
+typedef struct
+{
+    /// The maximum difference between the average of a cell and its
+    /// neighbours
+    double precision;
+    /// The log level to use for debugging
+    enum log_level log_level;
+    /// How the ghost rings are exchanged
+    enum halo_method halo;
+    /// Relax the inner cells of each block while its ghost ring is exchanged
+    bool overlap;
+    /// The number of sweeps between convergence checks, each reduction
+    /// completing while the sweeps up to the next check run, or 0 to finish
+    /// a check after every sweep. A solve can run up to 2k - 1 sweeps past
+    /// the one that converged
+    int check_interval;
+    /// Adapt the check interval to the rate of convergence
+    bool adaptive_check;
+    /// The number of sweeps between moving the block boundaries to even out
+    /// the measured sweep times, or 0 to keep the even split
+    int rebalance_interval;
+    /// How the ghost cells are encoded until the solve nears convergence
+    enum halo_codec halo_codec;
+    /// Leave alone the blocks no sweep could change by more than the
+    /// precision, and send no edges that have not changed
+    bool active_set;
+    /// The threads sharing the relaxation of each block, or NULL to relax it
+    /// on the main thread alone
+    thread_pool *pool;
+} solver_options;
+
+/// @brief The directions to the neighbouring blocks in the process grid.
+/// Opposite directions differ only in their lowest bit.
+enum direction
+{
+    DIRECTION_UP = 0,
+    DIRECTION_DOWN = 1,
+    DIRECTION_LEFT = 2,
+    DIRECTION_RIGHT = 3,
+    NUM_DIRECTIONS = 4
+};
+
+/// @brief The block of the matrix owned by one process, surrounded by a ring
+/// of ghost cells holding the edges of the neighbouring blocks or the fixed
+/// boundary of the matrix.
+typedef struct
+{
+    /// The dimension of the whole matrix
+    size_t size;
+    /// The cartesian communicator the matrix is split over
+    MPI_Comm comm;
+    /// The shape of the process grid, rows first
+    int dims[2];
+    /// The position of this process in the process grid
+    int coords[2];
+    /// The global index of the first inner row of each row of blocks, with a
+    /// final entry one past the last inner row
+    size_t *row_starts;
+    /// The global index of the first inner column of each column of blocks,
+    /// with a final entry one past the last inner column
+    size_t *column_starts;
+    /// The global index of the first owned row and column
+    size_t first_row;
+    size_t first_column;
+    /// The number of owned rows and columns
+    size_t rows;
+    size_t columns;
+    /// The dimension of the matrix the starting values are sampled from
+    size_t source_size;
+    /// The number of rings of ghost cells, each exchange allowing that many
+    /// sweeps
+    size_t halo_width;
+    /// The distance between the starts of consecutive rows of the cell arrays
+    size_t stride;
+    /// The number of cells of each cell array, and the offset of the first
+    /// owned cell
+    size_t length;
+    size_t first_cell;
+    /// The owned cells and their ghost rings, for the current and next
+    /// iteration
+    double *cells;
+    double *next;
+    /// Both cell arrays in a fixed order, to tell which one is current
+    double *cell_arrays[2];
+    /// The rank of the neighbour in each direction, or MPI_PROC_NULL
+    int neighbours[NUM_DIRECTIONS];
+    /// The rank of the neighbour in each direction exchanged with through
+    /// messages, or MPI_PROC_NULL
+    int message_neighbours[NUM_DIRECTIONS];
+    /// The offsets of the owned edge facing each direction and of the ghost
+    /// cells on that side
+    size_t edge_offsets[NUM_DIRECTIONS];
+    size_t ghost_offsets[NUM_DIRECTIONS];
+    /// The strided shape of the edge and ghost cells on each side
+    MPI_Datatype halo_types[NUM_DIRECTIONS];
+    /// The number of rows and columns of the edge and ghost cells on each
+    /// side
+    size_t halo_rows[NUM_DIRECTIONS];
+    size_t halo_columns[NUM_DIRECTIONS];
+    /// How the messages of the two-sided exchange are encoded
+    enum halo_codec codec;
+    /// The encoded edge sent and ghost cells received in each direction
+    unsigned char *codec_sends[NUM_DIRECTIONS];
+    unsigned char *codec_receives[NUM_DIRECTIONS];
+    /// Send the edges only after a sweep has changed them, keeping the ghost
+    /// cells of both cell arrays the same
+    bool active_set;
+    /// The edges have been sent since the last sweep
+    bool edges_sent;
+    /// The ghost cells on each side as the last sweep read them
+    double *active_ghosts[NUM_DIRECTIONS];
+    /// The threads relaxing the block, or NULL
+    thread_pool *pool;
+    /// Post the exchange as nonblocking requests, completed by halo_end()
+    bool nonblocking;
+    /// The requests of an exchange in progress
+    MPI_Request requests[2 * NUM_DIRECTIONS];
+    int num_requests;
+    /// Exchange through requests set up once for each of the two cell arrays
+    bool persistent;
+    MPI_Request persistent_requests[2][2 * NUM_DIRECTIONS];
+    int num_persistent_requests;
+    /// The set of persistent requests of the exchange in progress
+    int persistent_set;
+    /// Keep both cell arrays in a window shared with the processes on the
+    /// same node, or MPI_WIN_NULL
+    MPI_Win shared_window;
+    MPI_Comm node_comm;
+    /// The edge facing this block of the neighbour in each direction, in
+    /// each of its two cell arrays, or NULL if it is on another node
+    double *shared_edges[2][NUM_DIRECTIONS];
+    /// The distance between consecutive cells of each shared edge
+    size_t shared_steps[NUM_DIRECTIONS];
+    /// Put the edges into the ghost rings of the neighbours through a window
+    /// on each cell array, or MPI_WIN_NULL
+    MPI_Win rma_windows[2];
+    /// Synchronise with fences rather than with the group of neighbours
+    bool rma_fence;
+    MPI_Group rma_group;
+    /// The window of the exchange in progress
+    int rma_set;
+    /// The shape and offset of the ghost cells of the neighbour in each
+    /// direction that the facing edge is put into
+    MPI_Datatype rma_types[NUM_DIRECTIONS];
+    MPI_Aint rma_displacements[NUM_DIRECTIONS];
+    /// A graph communicator over the neighbours, exchanged with through one
+    /// neighbourhood collective, or MPI_COMM_NULL
+    MPI_Comm neighbour_comm;
+    /// The count, shape and byte offsets of the edge sent to and the ghost
+    /// cells received from each neighbour, in the order of the graph
+    int neighbour_counts[NUM_DIRECTIONS];
+    MPI_Datatype neighbour_types[NUM_DIRECTIONS];
+    MPI_Aint neighbour_sends[NUM_DIRECTIONS];
+    MPI_Aint neighbour_receives[NUM_DIRECTIONS];
+} domain;
+
+/// @brief A thread of a pool and its position in it.
+typedef struct
+{
+    thread_pool *pool;
+    int id;
+} pool_member;
+
+/// @brief The worker threads of one process. The main thread takes the first
+/// strip of every rectangle, so it alone calls MPI.
+struct thread_pool
+{
+    /// The number of threads, including the main thread
+    int num_threads;
+    /// The workers and the position of each one in the pool
+    pthread_t *threads;
+    pool_member *members;
+    /// Released once a rectangle is set, then once all of it is relaxed
+    pthread_barrier_t start;
+    pthread_barrier_t finish;
+    /// The rectangle being relaxed, from an offset into the cell arrays
+    domain *d;
+    size_t offset;
+    size_t rows;
+    size_t columns;
+    /// The largest change in the strip of each thread
+    double *changes;
+    /// Set to make the workers return
+    bool stop;
+};
+
+/// @brief A thread calling into MPI while the main thread computes, so that
+/// libraries which only progress requests inside MPI calls keep the
+/// exchanges moving.
+typedef struct
+{
+    /// A communicator nothing is sent on, probed to enter the library
+    MPI_Comm comm;
+    pthread_t thread;
+    /// Cleared to stop the thread
+    atomic_bool running;
+} progress_thread;
+
+/// The pause between the calls of a progress thread into MPI, in nanoseconds
+#define PROGRESS_INTERVAL 20000
+
+/// @brief The header at the start of a matrix written by domain_write(),
+/// followed by the rows of the matrix as native doubles.
+typedef struct
+{
+    /// Always MATRIX_FILE_MAGIC
+    char magic[8];
+    /// The number of rows and columns of the matrix
+    uint64_t rows;
+    uint64_t columns;
+    /// The size in bytes of each value
+    uint64_t value_size;
+} matrix_file_header;
+
+#define MATRIX_FILE_MAGIC "RELAXMAT"
+
 // --- Begin function prototypes ---
 
 /// @brief Print a square matrix to stdout
@@ -24,46 +291,579 @@ enum log_level
 /// @param size The dimension of the matrix
 void print_matrix(double *matrix, size_t size);
 
-/// @brief Create a square matrix with 1s on the left and top sides and 0s
-/// everywhere else.
+/// @brief Find the starting value of a cell of a square matrix with 1s on
+/// the sides and 0s everywhere else.
+/// @param size The dimension of the matrix
+/// @param i The row of the cell
+/// @param j The column of the cell
+/// @return The starting value of the cell
+double matrix_value(size_t size, size_t i, size_t j);
+
+/// @brief Create a whole square matrix with its starting values, to gather
+/// the blocks of the processes into for printing.
 /// @param size The dimension of the matrix
 /// @param log_level The log level to use for debugging
 /// @return A pointer to the matrix
 double *matrix_init(size_t size, enum log_level log_level);
 
-/// @brief Apply the relaxation technique to a matrix in parallel.
-/// @param matrix The matrix to relax
-/// @param size The dimension of the matrix
-/// @param precision The precision to use for the relaxation, i.e. the maximum
-/// difference between the average of a cell and its neighbours.
-/// @param num_processes The number of processes to use
-/// @param rank The rank of the current process
-/// @param log_level The log level to use for debugging
-void relax_matrix_parallel(double *matrix, size_t size, double precision,
-                           int num_processes, int rank,
-                           enum log_level log_level);
+/// @brief Apply the relaxation technique to the blocks of a domain in
+/// parallel.
+/// @param d The domain to relax, with the owned cells and ghost ring filled
+/// @param options The settings of the solve
+/// @return The number of iterations taken to converge
+int relax_domain(domain *d, const solver_options *options);
+
+/// @brief Apply the relaxation technique on a hierarchy of grids, halving the
+/// size at each level, with each coarse solution interpolated onto the next
+/// finer level as its starting point.
+/// @param d The domain of the finest level, with the owned cells and ghost
+/// ring filled
+/// @param options The settings of the solve
+/// @param levels The number of levels to use, including the finest one. Set
+/// to the number of levels actually used, as every level needs at least one
+/// cell per process.
+/// @return The number of iterations taken to converge on the finest level
+int relax_matrix_nested(domain *d, const solver_options *options,
+                        int *levels);
 
 /// @brief Use the relaxation technique to compute the average of a group of
 /// cells in a matrix.
-/// @param input The matrix to relax
-/// @param result The matrix to store the result in
-/// @param precision_reached A pointer to a boolean to store whether the
-/// precision has been reached
-/// @param dimension The dimension of the matrix
-/// @param input_size The number of cells to relax
-/// @param precision The precision to use for the relaxation, i.e. the maximum
-/// difference between the average of a cell and its neighbours.
-/// @note The input and result matrices must be of size dimension x dimension.
-void relax_cells(double *input, double *result, bool *precision_reached,
-                 size_t size, size_t input_size, double precision);
+/// @param input The first cell to relax
+/// @param result The cell to store the first result in
+/// @param rows The number of rows to relax
+/// @param columns The number of columns to relax
+/// @param stride The distance between the starts of consecutive rows
+/// @return The largest difference between the average of a cell and its
+/// previous value
+/// @note The input and result use the same layout. The cells surrounding the
+/// relaxed ones are only read.
+double relax_cells(double *input, double *result, size_t rows,
+                   size_t columns, size_t stride);
+
+/// @brief Choose the shape of the process grid, keeping the number of ghost
+/// cells of the largest block as small as possible.
+/// @param num_processes The number of processes to arrange
+/// @param size The dimension of the matrix
+/// @param dims Set to the number of rows and columns of the process grid
+/// @return False if the processes cannot be arranged so that every block
+/// owns at least one cell
+bool choose_process_grid(int num_processes, size_t size, int dims[2]);
+
+/// @brief Check that a number of processes can split a matrix into blocks
+/// wide enough for the ghost rings.
+/// @param num_processes The number of processes
+/// @param size The dimension of the matrix
+/// @param halo_width The number of rings of ghost cells around each block
+/// @return True if every block owns at least one cell and every ghost ring
+/// comes from the owned cells of one neighbour
+bool problem_fits(int num_processes, size_t size, int halo_width);
+
+/// @brief Split a matrix over a communicator and fill it with the starting
+/// values of the problem.
+/// @param d The domain to initialise
+/// @param comm The communicator of the processes to split the matrix over
+/// @param size The dimension of the matrix
+/// @param halo_width The number of rings of ghost cells around each block
+/// @param reorder Renumber the processes by node first
+/// @param log_level The log level to use for debugging
+void problem_create(domain *d, MPI_Comm comm, size_t size, int halo_width,
+                    bool reorder, enum log_level log_level);
+
+/// @brief Read a list of problems, one matrix size and precision per line.
+/// Blank lines and lines starting with # are skipped.
+/// @param path The path of the list
+/// @param sizes Set to the size of each problem
+/// @param precisions Set to the precision of each problem
+/// @return The number of problems, or -1 if the list could not be read
+int ensemble_read(const char *path, uint64_t **sizes, double **precisions);
+
+/// @brief Share the processes out between groups, each solving some of the
+/// problems in turn, so that every group has about as much work per process.
+/// @param sizes The size of each problem
+/// @param num_jobs The number of problems
+/// @param num_processes The number of processes
+/// @param halo_width The number of rings of ghost cells around each block
+/// @param groups Set to the group solving each problem
+/// @param group_sizes Set to the number of processes of each group
+/// @return The number of groups, or -1 if a problem is too small for its
+/// ghost rings even on one process
+int ensemble_schedule(const uint64_t *sizes, int num_jobs, int num_processes,
+                      int halo_width, int *groups, int *group_sizes);
+
+/// @brief Solve a list of problems concurrently on groups of the processes,
+/// printing the outcome of every problem from the root process.
+/// @param path The path of the list of problems
+/// @param options The settings shared by every solve
+/// @param levels The number of levels to use for every solve
+/// @param halo_width The number of rings of ghost cells around each block
+/// @param reorder Renumber the processes of each group by node
+/// @return True if every problem was solved
+bool ensemble_run(const char *path, const solver_options *options,
+                  int levels, int halo_width, bool reorder);
+
+/// @brief Renumber the processes so that each node owns a compact tile of
+/// the process grid, keeping most of the halo traffic within nodes.
+/// @param comm The communicator of the processes to split the matrix over
+/// @param size The dimension of the matrix
+/// @param log_level The log level to use for debugging
+/// @return A communicator whose rank order places the processes of each node
+/// in one tile of the row-major process grid, to be freed by the caller
+MPI_Comm reorder_by_node(MPI_Comm comm, size_t size,
+                         enum log_level log_level);
+
+/// @brief Split the matrix into blocks over a cartesian process grid and
+/// allocate the block of this process.
+/// @param d The domain to initialise
+/// @param size The dimension of the matrix
+/// @param halo_width The number of rings of ghost cells around each block
+/// @param comm The communicator of the processes to split the matrix over
+void domain_create(domain *d, size_t size, size_t halo_width, MPI_Comm comm);
+
+/// @brief Split a coarser matrix over the same process grid as a finer one,
+/// so that every fine block can be interpolated from the coarse block of the
+/// same process and its ghost ring. Coarse blocks have a single ghost ring.
+/// @param coarse The domain to initialise
+/// @param fine The domain of the finer matrix
+/// @param size The dimension of the coarser matrix
+/// @return False if some coarse block would own no cells, in which case
+/// nothing is allocated
+bool domain_coarsen(domain *coarse, const domain *fine, size_t size);
+
+/// @brief Move the starts of the rows and columns of blocks so that the
+/// slowest block of each row and column of the process grid would have
+/// taken as long as the others, and move the cells to their new owners.
+/// @param d The domain, which must not use any persistent setup of its
+/// exchanges
+/// @param sweep_time The time this process spent relaxing since the last
+/// rebalance
+/// @param log_level The log level to use for debugging
+void domain_rebalance(domain *d, double sweep_time, enum log_level log_level);
+
+/// @brief Split a range of rows or columns into consecutive parts, each
+/// sized in proportion to how fast its current part was relaxed.
+/// @param starts The starts of the current parts, with a final entry one
+/// past the end of the range
+/// @param times The time taken to relax each current part
+/// @param count The number of parts
+/// @param minimum The smallest number of rows or columns of any part
+/// @return The starts of the new parts, in the same form
+size_t *balance_starts(const size_t *starts, const double *times, int count,
+                       size_t minimum);
+
+/// @brief Copy the owned cells of one split of a matrix into another split
+/// of the same matrix over the same processes.
+/// @param from The domain holding the cells
+/// @param to The domain to fill the owned cells of, with its boundary and
+/// ghost rings already initialised
+void domain_redistribute(const domain *from, domain *to);
+
+/// @brief Find the block of this process from the starts of the blocks, and
+/// allocate its cells and the shapes of its halo.
+/// @param d The domain, with the size, communicator and block starts set
+void domain_layout(domain *d);
+
+/// @brief Free the memory and MPI objects of a domain.
+/// @param d The domain to free
+void domain_destroy(domain *d);
+
+/// @brief Count the bytes of one halo exchange that stay within a node and
+/// that cross between nodes, over all processes.
+/// @param d The domain
+/// @param bytes Set to the bytes within nodes, then between nodes
+void domain_locality(const domain *d, uint64_t bytes[2]);
+
+/// @brief Find the block, including its ghost ring, owned by a process.
+/// @param d The domain
+/// @param rank The rank of the process in the cartesian communicator
+/// @param starts Set to the global index of the first owned row and column
+/// @param counts Set to the number of owned rows and columns
+void domain_block(const domain *d, int rank, size_t starts[2],
+                  size_t counts[2]);
+
+/// @brief Create and commit the type of a strided group of rows of doubles.
+/// @param rows The number of rows
+/// @param columns The number of doubles in each row
+/// @param stride The distance between the starts of consecutive rows
+/// @param type Set to the new type
+/// @note Before MPI 4 every argument has to fit in an int, as main() checks.
+void type_rows(size_t rows, size_t columns, size_t stride,
+               MPI_Datatype *type);
+
+/// @brief Create and commit the type of a rectangle of doubles within a
+/// larger row-major array.
+/// @param sizes The number of rows and columns of the array
+/// @param counts The number of rows and columns of the rectangle
+/// @param starts The first row and column of the rectangle
+/// @param type Set to the new type
+/// @note Before MPI 4 every argument has to fit in an int, as main() checks.
+void type_rectangle(const size_t sizes[2], const size_t counts[2],
+                    const size_t starts[2], MPI_Datatype *type);
+
+/// @brief Fill the block of this process and its ghost ring with the
+/// starting values of the problem, sampled from a matrix of a possibly
+/// different size.
+/// @param d The domain
+/// @param source_size The dimension of the matrix the problem is defined on
+void domain_init(domain *d, size_t source_size);
+
+/// @brief Bilinearly interpolate the owned cells of a fine domain from a
+/// coarse one created by domain_coarsen(), both covering the same unit
+/// square.
+/// @param coarse The coarse domain, with its ghost ring and corners filled
+/// @param fine The fine domain to write the owned cells of
+void domain_interpolate(const domain *coarse, domain *fine);
+
+/// @brief Collect the owned cells of every process into the matrix.
+/// @param d The domain
+/// @param matrix The whole matrix, only used on the root process
+void domain_gather(domain *d, double *matrix);
+
+/// @brief Write the whole matrix to a binary file, with every process
+/// writing its own block in one collective call.
+/// @param d The domain
+/// @param path The path of the file to create
+/// @param aggregators The number of processes collecting the writes, or 0 to
+/// let the MPI library decide
+/// @return True if the file was written
+bool domain_write(domain *d, const char *path, int aggregators);
+
+/// @brief Relax a rectangle of owned cells of a block.
+/// @param d The domain
+/// @param row The first row to relax, relative to the first owned row
+/// @param column The first column to relax, relative to the first owned column
+/// @param rows The number of rows to relax
+/// @param columns The number of columns to relax
+/// @return The largest change of any relaxed cell
+double relax_region(domain *d, size_t row, size_t column, size_t rows,
+                    size_t columns);
+
+/// @brief Relax the owned cells of a block and some of its ghost rings on
+/// the sides facing a neighbour.
+/// @param d The domain
+/// @param rings The number of ghost rings to relax as well
+void relax_extended(domain *d, size_t rings);
+
+/// @brief Start exchanging the edges of the block with the neighbouring
+/// processes. Blocking exchanges complete here.
+/// @param d The domain
+void halo_begin(domain *d);
+
+/// @brief Wait for the exchange started by halo_begin() to fill the ghost
+/// ring.
+/// @param d The domain
+void halo_end(domain *d);
+
+/// @brief Set up the exchanges of both cell arrays as persistent requests,
+/// used by halo_begin() and halo_end() until halo_persistent_free().
+/// @param d The domain
+void halo_persistent_init(domain *d);
+
+/// @brief Free the persistent requests of a domain.
+/// @param d The domain
+void halo_persistent_free(domain *d);
+
+/// @brief Move both cell arrays into a window shared by the processes on
+/// each node, so halo_begin() reads the edges of neighbours on the same node
+/// straight from their memory. The window lives until domain_destroy().
+/// @param d The domain
+void halo_shared_init(domain *d);
+
+/// @brief Create a window on each cell array, used by halo_begin() and
+/// halo_end() to put the edges of the block into the ghost rings of the
+/// neighbours until halo_rma_free().
+/// @param d The domain
+/// @param fence Synchronise with fences rather than post-start-complete-wait
+/// epochs
+void halo_rma_init(domain *d, bool fence);
+
+/// @brief Free the windows and datatypes of the one-sided exchange.
+/// @param d The domain
+void halo_rma_free(domain *d);
+
+/// @brief Create a graph communicator over the neighbours of the block, used
+/// by halo_begin() and halo_end() to exchange the whole ghost ring in one
+/// neighbourhood collective until halo_neighbour_free().
+/// @param d The domain, with a ghost ring one cell wide
+void halo_neighbour_init(domain *d);
+
+/// @brief Free the graph communicator of the neighbourhood exchange.
+/// @param d The domain
+void halo_neighbour_free(domain *d);
+
+/// @brief Encode the messages of the two-sided exchange, until
+/// halo_codec_free().
+/// @param d The domain
+/// @param codec The encoding to use
+void halo_codec_init(domain *d, enum halo_codec codec);
+
+/// @brief Free the message buffers of a halo codec.
+/// @param d The domain
+void halo_codec_free(domain *d);
+
+/// @brief Find the size of an encoded message of the ghost cells on one side.
+/// @param d The domain
+/// @param direction The side of the block
+/// @return The number of bytes
+size_t halo_codec_bytes(const domain *d, int direction);
+
+/// @brief Encode the owned edge facing a direction.
+/// @param d The domain
+/// @param direction The side of the block
+/// @param buffer Set to the encoded cells
+void halo_encode(const domain *d, int direction, unsigned char *buffer);
+
+/// @brief Decode the ghost cells on one side of the block.
+/// @param d The domain
+/// @param direction The side of the block
+/// @param buffer The encoded cells
+void halo_decode(domain *d, int direction, const unsigned char *buffer);
+
+/// @brief Stop encoding the ghost cells once the largest change of a sweep
+/// comes within a fixed factor of the precision, or gets close to the
+/// resolution of the codec.
+/// @param d The domain
+/// @param change The largest change of any cell in the last checked sweep
+/// @param precision The precision of the solve
+/// @return True if the codec was switched off by this call
+bool halo_codec_update(domain *d, double change, double precision);
+
+/// @brief Start sending each edge only once after every sweep of the block.
+/// @param d The domain
+void active_set_init(domain *d);
+
+/// @brief Go back to sending every edge on every exchange.
+/// @param d The domain
+void active_set_free(domain *d);
+
+/// @brief Keep the ghost cells the next sweep reads.
+/// @param d The domain
+void active_set_save(domain *d);
+
+/// @brief Measure how far the ghost cells have moved since the last sweep.
+/// @param d The domain
+/// @return The largest change of any ghost cell
+double active_set_drift(const domain *d);
+
+/// @brief Exchange the corner cells of the block with the diagonal
+/// neighbours, which the relaxation itself never reads.
+/// @param d The domain
+void halo_corners(domain *d);
+
+/// @brief Start the worker threads of a pool.
+/// @param pool The pool to start
+/// @param num_threads The number of threads, including the main thread
+void pool_start(thread_pool *pool, int num_threads);
+
+/// @brief Stop the worker threads of a pool and wait for them to finish.
+/// @param pool The pool to stop
+void pool_stop(thread_pool *pool);
+
+/// @brief Relax a strip of the rectangle set in a pool.
+/// @param pool The pool
+/// @param id The position of the thread in the pool
+void pool_relax_strip(thread_pool *pool, int id);
+
+/// @brief Relax the strips of rectangles until the pool is stopped.
+/// @param args The member of the pool the thread runs as
+/// @return NULL
+void *pool_worker(void *args);
+
+/// @brief Relax a rectangle of a block, split into strips of rows over the
+/// threads of its pool when it has enough rows.
+/// @param d The domain
+/// @param offset The offset of the first cell into the cell arrays
+/// @param rows The number of rows to relax
+/// @param columns The number of columns to relax
+/// @return The largest change of any relaxed cell
+double relax_span(domain *d, size_t offset, size_t rows, size_t columns);
+
+/// @brief Start a thread driving the progress of MPI requests.
+/// @param p The progress thread to start
+/// @param comm The communicator of the processes
+void progress_start(progress_thread *p, MPI_Comm comm);
+
+/// @brief Stop a progress thread and wait for it to finish.
+/// @param p The progress thread to stop
+void progress_stop(progress_thread *p);
+
+/// @brief Poll MPI until the progress thread is stopped.
+/// @param args The progress thread
+/// @return NULL
+void *progress_loop(void *args);
 
 // --- End function prototypes ---
 
 int main(int argc, char *argv[])
 {
     int rank, num_processes, err;
-    // Initialise MPI
-    err = MPI_Init(&argc, &argv);
+
+    // Create variables to store command line arguments
+    enum log_level log_level;
+    size_t size;
+    double precision;
+    int levels = 1;
+    solver_options options = {0};
+    int halo_width = 1;
+    const char *output = NULL;
+    int aggregators = 0;
+    bool reorder = false;
+    bool progress = false;
+    int threads = 1;
+    const char *jobs = NULL;
+
+    const char *usage =
+        "Usage: %s [--levels n] "
+        "[--halo sendrecv|persistent|shared|rma-fence|rma-pscw|neighbour] "
+        "[--halo-width k] [--overlap] "
+        "[--check-interval k|auto] [--rebalance r] "
+        "[--halo-codec float|quantize] [--active-set] [--reorder] "
+        "[--progress-thread] "
+        "[--threads t] "
+        "[--output file] [--aggregators n] "
+        "(<matrix size> <precision> | --jobs file) [log level]";
+    static struct option long_options[] = {
+        {"levels", required_argument, NULL, 'l'},
+        {"halo", required_argument, NULL, 'h'},
+        {"halo-width", required_argument, NULL, 'w'},
+        {"overlap", no_argument, NULL, 'o'},
+        {"check-interval", required_argument, NULL, 'c'},
+        {"rebalance", required_argument, NULL, 'r'},
+        {"halo-codec", required_argument, NULL, 'z'},
+        {"active-set", no_argument, NULL, 's'},
+        {"reorder", no_argument, NULL, 'n'},
+        {"progress-thread", no_argument, NULL, 'p'},
+        {"threads", required_argument, NULL, 't'},
+        {"output", required_argument, NULL, 'f'},
+        {"aggregators", required_argument, NULL, 'a'},
+        {"jobs", required_argument, NULL, 'j'},
+        {NULL, 0, NULL, 0}};
+
+    // Parse options
+    int option;
+    while ((option = getopt_long(argc, argv, "", long_options, NULL)) != -1)
+    {
+        switch (option)
+        {
+        case 'l':
+            levels = atoi(optarg);
+            if (levels < 1)
+            {
+                fprintf(stderr, "Level count must be greater than 0\n");
+                return 1;
+            }
+            break;
+        case 'h':
+            if (strcmp(optarg, "sendrecv") == 0)
+                options.halo = HALO_SENDRECV;
+            else if (strcmp(optarg, "persistent") == 0)
+                options.halo = HALO_PERSISTENT;
+            else if (strcmp(optarg, "shared") == 0)
+                options.halo = HALO_SHARED;
+            else if (strcmp(optarg, "rma-fence") == 0)
+                options.halo = HALO_RMA_FENCE;
+            else if (strcmp(optarg, "rma-pscw") == 0)
+                options.halo = HALO_RMA_PSCW;
+            else if (strcmp(optarg, "neighbour") == 0)
+                options.halo = HALO_NEIGHBOUR;
+            else
+            {
+                fprintf(stderr, "Unknown halo exchange %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'w':
+            halo_width = atoi(optarg);
+            if (halo_width < 1)
+            {
+                fprintf(stderr, "Halo width must be greater than 0\n");
+                return 1;
+            }
+            break;
+        case 'o':
+            options.overlap = true;
+            break;
+        case 'c':
+            if (strcmp(optarg, "auto") == 0)
+            {
+                // Start often, then space the checks out as the rate of
+                // convergence becomes known
+                options.check_interval = 8;
+                options.adaptive_check = true;
+            }
+            else
+            {
+                options.check_interval = atoi(optarg);
+                if (options.check_interval < 1)
+                {
+                    fprintf(stderr,
+                            "Check interval must be greater than 0 or auto\n");
+                    return 1;
+                }
+            }
+            break;
+        case 'r':
+            options.rebalance_interval = atoi(optarg);
+            if (options.rebalance_interval < 1)
+            {
+                fprintf(stderr, "Rebalance interval must be greater than 0\n");
+                return 1;
+            }
+            break;
+        case 'z':
+            if (strcmp(optarg, "float") == 0)
+                options.halo_codec = HALO_CODEC_FLOAT;
+            else if (strcmp(optarg, "quantize") == 0)
+                options.halo_codec = HALO_CODEC_QUANTIZE;
+            else
+            {
+                fprintf(stderr, "Unknown halo codec %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 's':
+            options.active_set = true;
+            break;
+        case 'n':
+            reorder = true;
+            break;
+        case 'p':
+            progress = true;
+            break;
+        case 't':
+            threads = atoi(optarg);
+            if (threads < 1)
+            {
+                fprintf(stderr, "Thread count must be greater than 0\n");
+                return 1;
+            }
+            break;
+        case 'f':
+            output = optarg;
+            break;
+        case 'j':
+            jobs = optarg;
+            break;
+        case 'a':
+            aggregators = atoi(optarg);
+            if (aggregators < 1)
+            {
+                fprintf(stderr, "Aggregator count must be greater than 0\n");
+                return 1;
+            }
+            break;
+        default:
+            fprintf(stderr, usage, argv[0]);
+            return 1;
+        }
+    }
+
+    /* Initialise MPI, letting a progress thread call it alongside this one.
+    Worker threads only compute, leaving the calls to the main thread */
+    int required = progress      ? MPI_THREAD_MULTIPLE
+                   : threads > 1 ? MPI_THREAD_FUNNELED
+                                 : MPI_THREAD_SINGLE;
+    int provided;
+    err = MPI_Init_thread(&argc, &argv, required, &provided);
     err += MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     err += MPI_Comm_size(MPI_COMM_WORLD, &num_processes);
 
@@ -72,25 +872,32 @@ int main(int argc, char *argv[])
         fprintf(stderr, "Error initializing MPI. \n");
         return 1;
     }
+    if (provided < required)
+    {
+        if (rank == 0)
+            fprintf(stderr, "The MPI library does not support the threads "
+                            "of --progress-thread or --threads\n");
+        MPI_Finalize();
+        return 1;
+    }
 
-    // Create variables to store command line arguments
-    enum log_level log_level;
-    size_t size;
-    double precision;
+    // Positional arguments follow the options
+    int num_args = argc - optind;
+    char **args = argv + optind;
 
-    // Check for correct number of arguments
-    if (argc < 3 || argc > 4)
+    // Check for correct number of arguments, a list of jobs replacing the size
+    // and precision
+    int problem_args = jobs != NULL ? 0 : 2;
+    if (num_args < problem_args || num_args > problem_args + 1)
     {
-        fprintf(stderr,
-                "Usage: %s <matrix size> <precision> [log level]",
-                argv[0]);
+        fprintf(stderr, usage, argv[0]);
         return 1;
     }
 
-    if (argc == 4)
+    if (num_args == problem_args + 1)
     {
         // Parse log level
-        log_level = atoi(argv[3]);
+        log_level = atoi(args[problem_args]);
         // Validate log level -
         if (log_level < LOG_ALL || log_level > LOG_NONE)
         {
@@ -105,8 +912,70 @@ int main(int argc, char *argv[])
         log_level = LOG_NONE;
     }
 
+    // The ghost rows have to arrive before the ghost columns carry them on
+    if (halo_width > 1 && (options.halo != HALO_SENDRECV || options.overlap))
+    {
+        fprintf(stderr, "Halo width greater than 1 only works with --halo "
+                        "sendrecv and without --overlap\n");
+        return 1;
+    }
+
+    // The other exchanges are set up for the cell arrays of one split
+    if (options.rebalance_interval > 0 && options.halo != HALO_SENDRECV)
+    {
+        fprintf(stderr, "Rebalancing only works with --halo sendrecv\n");
+        return 1;
+    }
+
+    // Only the messages of the two-sided exchange can be encoded
+    if (options.halo_codec != HALO_CODEC_NONE && options.halo != HALO_SENDRECV)
+    {
+        fprintf(stderr, "Halo codecs only work with --halo sendrecv\n");
+        return 1;
+    }
+
+    /* Which blocks are swept is decided from the ghost cells, so they have
+    to arrive whole before any sweep starts */
+    if (options.active_set &&
+        (options.halo != HALO_SENDRECV || options.overlap || halo_width > 1 ||
+         options.halo_codec != HALO_CODEC_NONE))
+    {
+        fprintf(stderr, "Active set only works with --halo sendrecv, without "
+                        "--overlap, --halo-width or --halo-codec\n");
+        return 1;
+    }
+
+    // Each job only reports its outcome
+    if (jobs != NULL && output != NULL)
+    {
+        fprintf(stderr, "Writing the matrix does not work with --jobs\n");
+        return 1;
+    }
+
+    thread_pool pool;
+    progress_thread poller;
+    if (jobs != NULL)
+    {
+        if (threads > 1)
+        {
+            pool_start(&pool, threads);
+            options.pool = &pool;
+        }
+        options.log_level = log_level;
+        if (progress)
+            progress_start(&poller, MPI_COMM_WORLD);
+        bool solved = ensemble_run(jobs, &options, levels, halo_width, reorder);
+        if (progress)
+            progress_stop(&poller);
+        if (threads > 1)
+            pool_stop(&pool);
+
+        MPI_Finalize();
+        return solved ? 0 : 1;
+    }
+
     // Parse size
-    size = atoi(argv[1]);
+    size = strtoull(args[0], NULL, 10);
     // Validate size
     if (size < 2 || size > 10e6)
     {
@@ -115,7 +984,7 @@ int main(int argc, char *argv[])
     }
 
     // Parse precision
-    precision = atof(argv[2]);
+    precision = atof(args[1]);
     // Validate precision
     if (precision <= 0)
     {
@@ -123,78 +992,110 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    if (num_processes > (size - 2))
+    int dims[2];
+    if (!choose_process_grid(num_processes, size, dims))
     {
         printf(
-            "Process count is greater than the number of rows. "
-            "Please reduce the number of processes.\n");
+            "Process count cannot be arranged into a grid of blocks of the "
+            "matrix. Please reduce the number of processes.\n");
         return 1;
     }
 
-    if (rank == 0)
+    // Every ghost ring has to come from the owned cells of one neighbour
+    if (!problem_fits(num_processes, size, halo_width))
+    {
+        fprintf(stderr, "Halo width cannot be larger than the smallest "
+                        "block of the matrix\n");
+        return 1;
+    }
+
+    options.precision = precision;
+    options.log_level = log_level;
+
+    if (rank == 0 && log_level <= LOG_DEBUG)
+        printf("Initializing matrix of size %zu x %zu \n", size, size);
+
+    // Each process only ever holds its own block of the matrix
+    domain d;
+    problem_create(&d, MPI_COMM_WORLD, size, halo_width, reorder, log_level);
+
+    if (threads > 1)
+    {
+        pool_start(&pool, threads);
+        options.pool = &pool;
+    }
+    if (progress)
+        progress_start(&poller, d.comm);
+    int iterations = relax_matrix_nested(&d, &options, &levels);
+    if (progress)
+        progress_stop(&poller);
+    if (threads > 1)
+        pool_stop(&pool);
+
+    bool written = true;
+    if (output != NULL)
     {
-        // Only allocate the matrix on the root process to save memory
-        double *matrix = matrix_init(size, log_level);
+        double start = MPI_Wtime();
+        written = domain_write(&d, output, aggregators);
+        if (written && rank == 0 && log_level <= LOG_INFO)
+            printf("Wrote %s in %fs \n", output, MPI_Wtime() - start);
+    }
 
-        relax_matrix_parallel(matrix, size, precision, num_processes, rank,
-                              log_level);
+    if (log_level <= LOG_INFO)
+    {
+        // Printing needs the whole matrix on the root process
+        double *matrix = NULL;
+        if (rank == 0)
+            matrix = matrix_init(size, log_level);
+        domain_gather(&d, matrix);
 
-        if (log_level <= LOG_INFO)
+        if (rank == 0)
         {
+            printf("Converged after %d iterations using %d levels \n",
+                   iterations, levels);
             printf("Final matrix:\n");
             print_matrix(matrix, size);
-        }
 
-        // Free memory
-        free(matrix);
-        if (log_level <= LOG_ALL)
-            printf("Freed matrix at %p \n", matrix);
-    }
-    else
-    {
-        // No matrix to pass in on non-root processes
-        relax_matrix_parallel(NULL, size, precision, num_processes, rank,
-                              log_level);
+            // Free memory
+            free(matrix);
+            if (log_level <= LOG_ALL)
+                printf("Freed matrix at %p \n", matrix);
+        }
     }
 
+    domain_destroy(&d);
+
     // Finalise the MPI environment
     MPI_Finalize();
 
+    return written ? 0 : 1;
+}
+
+double matrix_value(size_t size, size_t i, size_t j)
+{
+    // Set the sides to 1
+    /** This is done to improve the interpretation and reproducibility of
+        timing results across different matrix sizes. This particular
+        pattern was chosen because it is easy to see the effect of the
+        relaxation method on the matrix and ... [TODO: finish this]
+    */
+    if (i == 0 || j == 0 || i == size - 1 || j == size - 1)
+        return 1;
+
+    // All other cells start at 0
     return 0;
 }
 
 double *matrix_init(size_t size, enum log_level log_level)
 {
-    if (log_level <= LOG_DEBUG)
-        fprintf(stdout, "Initializing matrix of size %zu x %zu \n", size, size);
-
     // Allocate memory for the matrix
-    double *result = calloc(size * size, sizeof(double *));
+    double *result = malloc(size * size * sizeof(double));
     if (log_level <= LOG_ALL)
         printf("Allocated matrix at %p \n", result);
 
-    // Randomly initialize the matrix
-    for (size_t i = 0; i < size * size; i++)
-    {
-        // Set the sides to 1
-        /** This is done to improve the interpretation and reproducibility of
-            timing results across different matrix sizes. This particular
-            pattern was chosen because it is easy to see the effect of the
-            relaxation method on the matrix and ... [TODO: finish this]
-        */
-        if (i % size == 0 || i < size || i >= size * (size - 1) ||
-            i % size == size - 1)
-        {
-            result[i] = 1;
-        }
-        // All other cells are initialised at 0 by calloc
-    }
-
-    if (log_level <= LOG_DEBUG)
-    {
-        printf("Matrix initialized \n");
-        print_matrix(result, size);
-    }
+    for (size_t i = 0; i < size; i++)
+        for (size_t j = 0; j < size; j++)
+            result[i * size + j] = matrix_value(size, i, j);
 
     return result;
 }
@@ -213,134 +1114,2116 @@ void print_matrix(double *matrix, size_t size)
     printf("\n");
 }
 
-// Use the relaxation method to relax a 2d array
-void relax_matrix_parallel(double *matrix, size_t size, double precision,
-                           int num_processes, int rank,
-                           enum log_level log_level)
+int relax_matrix_nested(domain *d, const solver_options *options,
+                        int *levels)
 {
-    // Create arrays to store the scatter and gather counts and displacements
-    int *scatter_displ = calloc(num_processes, sizeof(int));
-    int *scatter_count = calloc(num_processes, sizeof(int));
-    int *gather_count = calloc(num_processes, sizeof(int));
-    int *gather_displ = calloc(num_processes, sizeof(int));
+    // Every level is split over the same process grid as the finest one
+    domain domains[64];
+    domains[0] = *d;
+    int num_levels = 1;
+    while (num_levels < *levels && num_levels < 64 &&
+           domain_coarsen(&domains[num_levels], &domains[num_levels - 1],
+                          (domains[num_levels - 1].size + 1) / 2))
+        num_levels++;
+    *levels = num_levels;
 
-    // Calculate the number of rows to send to each process
-    size_t rows_per_process = (size - 2) / num_processes;
-    // Calculate the number of rows that will be left over
-    size_t rows_remainder = (size - 2) % num_processes;
+    if (num_levels > 1)
+        domain_init(&domains[num_levels - 1], d->size);
 
-    size_t scatter_offset = 0;
-    for (int i = 0; i < num_processes; i++)
+    for (int level = num_levels - 1; level > 0; level--)
     {
-        // Starting position for each chunk
-        scatter_displ[i] = scatter_offset;
-        // Send each row its working rows and the rows above and below
-        scatter_count[i] = (rows_per_process + 2) * size;
+        domain *coarse = &domains[level];
+        domain *fine = &domains[level - 1];
+
+        int rank;
+        MPI_Comm_rank(coarse->comm, &rank);
+        if (rank == 0 && options->log_level <= LOG_DEBUG)
+            printf("Solving level %d of size %zu x %zu \n", level,
+                   coarse->size, coarse->size);
+
+        relax_domain(coarse, options);
 
-        /* If there are rows left over, give each process one until there are
-        none left */
-        if (rows_remainder > 0)
+        // Undo any rebalancing, so the coarse blocks line up with the fine
+        if (options->rebalance_interval > 0)
         {
-            scatter_count[i] += size;
-            rows_remainder--;
+            domain split;
+            domain_coarsen(&split, fine, coarse->size);
+            domain_init(&split, d->size);
+            domain_redistribute(coarse, &split);
+            domain_destroy(coarse);
+            *coarse = split;
         }
 
-        // Update the offset for the next process
-        scatter_offset += scatter_count[i] - (2 * size);
+        // The interpolation reads the whole ghost ring, corners included
+        coarse->nonblocking = false;
+        halo_begin(coarse);
+        halo_end(coarse);
+        halo_corners(coarse);
 
-        // Only receive the rows that are being worked on
-        gather_count[i] = scatter_count[i] - (2 * size);
-        gather_displ[i] = scatter_displ[i] + size;
+        // Sample the boundary of the original problem, then start the inner
+        // cells from the solution of the coarser level
+        if (level > 1)
+            domain_init(fine, d->size);
+        domain_interpolate(coarse, fine);
+        domain_destroy(coarse);
     }
 
-    // Allocate memory for the send and receive buffers
-    double *send_buffer = calloc(scatter_count[rank], sizeof(double));
-    double *recv_buffer = calloc(gather_count[rank], sizeof(double));
+    return relax_domain(d, options);
+}
+
+// Use the relaxation method to relax a 2d array
+int relax_domain(domain *d, const solver_options *options)
+{
+    int rank;
+    MPI_Comm_rank(d->comm, &rank);
+    double precision = options->precision;
+    enum log_level log_level = options->log_level;
+    d->nonblocking = options->overlap;
+    d->pool = options->pool;
 
     if (log_level <= LOG_DEBUG)
-        printf("Process %d: Scatter displ: %d, Scatter count: %d"
-               "Gather displ: %d, Gather count: % d\n ",
-               rank, scatter_displ[rank], scatter_count[rank],
-               gather_displ[rank], gather_count[rank]);
+        printf("Process %d: rows %zu to %zu, columns %zu to %zu of a "
+               "%d x %d process grid \n",
+               rank, d->first_row, d->first_row + d->rows - 1,
+               d->first_column, d->first_column + d->columns - 1, d->dims[0],
+               d->dims[1]);
+
+    // The whole matrix is only gathered every iteration on request
+    double *matrix = NULL;
+    if (log_level <= LOG_DEBUG && rank == 0)
+        matrix = matrix_init(d->size, LOG_NONE);
+
+    // The fixed boundary is never relaxed, so copy it into the next cells
+    memcpy(d->next, d->cells, d->length * sizeof(double));
+
+    // The exchanges are the same every iteration, so set them up once
+    if (options->halo == HALO_PERSISTENT)
+        halo_persistent_init(d);
+    if (options->halo == HALO_SHARED && d->shared_window == MPI_WIN_NULL)
+        halo_shared_init(d);
+    if (options->halo == HALO_RMA_FENCE || options->halo == HALO_RMA_PSCW)
+        halo_rma_init(d, options->halo == HALO_RMA_FENCE);
+    if (options->halo == HALO_NEIGHBOUR)
+        halo_neighbour_init(d);
+    if (options->halo_codec != HALO_CODEC_NONE)
+        halo_codec_init(d, options->halo_codec);
+    int encoded_iterations = 0;
+    if (options->active_set)
+        active_set_init(d);
+
+    /* The largest change of the last sweep of this block. With its ghost
+    cells fixed, the next sweep changes no cell by more than that, and each
+    ghost cell moving adds at most its own move */
+    double quiet_change = INFINITY;
+    int skipped_sweeps = 0;
+    int quiet_exchanges = 0;
+
+    /* Time a few exchanges on their own, to estimate how much of the
+    communication is hidden behind the inner cells when overlapping */
+    double exchange_time = 0;
+    if (options->overlap)
+    {
+        const int samples = 4;
+        double start = MPI_Wtime();
+        for (int sample = 0; sample < samples; sample++)
+        {
+            halo_begin(d);
+            halo_end(d);
+        }
+        exchange_time = (MPI_Wtime() - start) / samples;
+    }
+    double exposed_time = 0;
+    double hidden_time = 0;
 
     // Store the convergence information for each process
-    bool local_precision = true;
-    bool global_precision = false;
+    double local_change = 0;
+    double global_change = 0;
+    double checked_change = 0;
+    MPI_Request check = MPI_REQUEST_NULL;
+#if MPI_VERSION >= 4
+    // So is the reduction, which MPI 4 can set up once as well
+    if (options->halo == HALO_PERSISTENT && options->check_interval > 0)
+        MPI_Allreduce_init(&local_change, &global_change, 1, MPI_DOUBLE,
+                           MPI_MAX, d->comm, MPI_INFO_NULL, &check);
+#endif
+    bool reducing = false;
+    int interval = options->check_interval;
+    int next_check = interval > 0 ? interval : 1;
+    // The iterations the pending and the last finished reduction were of
+    int reduced_iteration = 0;
+    int checked_iteration = 0;
+    int num_checks = 0;
+    bool converged = false;
     int iterations = 0;
+    int next_rebalance = options->rebalance_interval;
+    double sweep_time = 0;
 
     // Loop until the matrix converges
-    while (!global_precision)
+    while (!converged)
     {
-        //  Scatter from root process into all other processes
-        MPI_Scatterv(matrix, scatter_count, scatter_displ, MPI_DOUBLE,
-                     send_buffer, scatter_count[rank], MPI_DOUBLE,
-                     0, MPI_COMM_WORLD);
+        // Only the edges of each block are communicated
+        double sweep_start = MPI_Wtime();
+        double start = sweep_start;
+        if (d->active_set && d->edges_sent)
+            quiet_exchanges++;
+        halo_begin(d);
+        double exposed = MPI_Wtime() - start;
+
+        double change;
+        bool swept = true;
+        if (options->overlap && d->rows > 2 && d->columns > 2)
+        {
+            // The inner cells of the block do not read the ghost ring
+            change = relax_region(d, 1, 1, d->rows - 2, d->columns - 2);
+
+            start = MPI_Wtime();
+            halo_end(d);
+            exposed += MPI_Wtime() - start;
+
+            // Finish the frame of cells bordering the ghost ring
+            change = fmax(change, relax_region(d, 0, 0, 1, d->columns));
+            change = fmax(change,
+                          relax_region(d, d->rows - 1, 0, 1, d->columns));
+            change = fmax(change, relax_region(d, 1, 0, d->rows - 2, 1));
+            change = fmax(change,
+                          relax_region(d, 1, d->columns - 1, d->rows - 2, 1));
+
+            if (exchange_time > exposed)
+                hidden_time += exchange_time - exposed;
+        }
+        else
+        {
+            start = MPI_Wtime();
+            halo_end(d);
+            exposed += MPI_Wtime() - start;
 
-        // Each process relaxes its own section of the matrix
-        relax_cells(send_buffer, recv_buffer, &local_precision, size,
-                    scatter_count[rank], precision);
+            /* Deep ghost rings allow several sweeps per exchange, each one
+            also relaxing one ring fewer of the ghost cells */
+            for (size_t rings = d->halo_width - 1; rings > 0; rings--)
+            {
+                relax_extended(d, rings);
+                double *temp = d->cells;
+                d->cells = d->next;
+                d->next = temp;
+                iterations++;
+            }
 
-        // Check convergence information from each process
-        MPI_Allreduce(&local_precision, &global_precision, 1, MPI_C_BOOL,
-                      MPI_LAND, MPI_COMM_WORLD);
+            /* Leave the block alone while no sweep could change it by more
+            than the precision, still reporting that bound to the checks */
+            double bound = d->active_set
+                               ? quiet_change + active_set_drift(d)
+                               : INFINITY;
+            if (bound <= precision)
+            {
+                change = bound;
+                swept = false;
+                skipped_sweeps++;
+            }
+            else
+            {
+                // Each process relaxes its own section of the matrix
+                if (d->active_set)
+                    active_set_save(d);
+                change = relax_region(d, 0, 0, d->rows, d->columns);
+                quiet_change = change;
+                d->edges_sent = false;
+            }
+        }
+        exposed_time += exposed;
+        sweep_time += MPI_Wtime() - sweep_start - exposed;
 
-        // Gather from all other processes into root process
-        MPI_Gatherv(recv_buffer, gather_count[rank], MPI_DOUBLE, matrix,
-                    gather_count, gather_displ, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+        // Swap the cells, unless the block was left alone
+        if (swept)
+        {
+            double *temp = d->cells;
+            d->cells = d->next;
+            d->next = temp;
+        }
 
         iterations++;
-        if (log_level <= LOG_DEBUG && rank == 0)
+
+        /* Every process reaches each check on the same iteration, so they all
+        agree on when to stop */
+        if (iterations >= next_check)
         {
-            printf("Finished iteration %d \n", iterations);
-            print_matrix(matrix, size);
+            if (reducing)
+            {
+                // Finish the reduction started at the previous check
+                MPI_Wait(&check, MPI_STATUS_IGNORE);
+                reducing = false;
+                converged = global_change <= precision;
+                num_checks++;
+
+                // Finish with exact ghost cells before converging
+                if (halo_codec_update(d, global_change, precision))
+                {
+                    converged = false;
+                    encoded_iterations = reduced_iteration;
+                }
+
+                if (options->adaptive_check && !converged &&
+                    checked_iteration > 0 && global_change < checked_change)
+                {
+                    // Aim half way to the sweep the precision is expected on
+                    double rate = log(global_change / checked_change) /
+                                  (reduced_iteration - checked_iteration);
+                    double remaining = log(precision / global_change) / rate;
+                    interval = remaining / 2 < 1     ? 1
+                               : remaining / 2 > 256 ? 256
+                                                     : (int)(remaining / 2);
+                }
+                if (rank == 0 && log_level <= LOG_DEBUG)
+                    printf("Largest change %e after iteration %d, next check "
+                           "in %d iterations \n",
+                           global_change, reduced_iteration, interval);
+                checked_change = global_change;
+                checked_iteration = reduced_iteration;
+            }
+
+            // Check convergence information from each process
+            local_change = change;
+            reduced_iteration = iterations;
+            if (options->check_interval == 0)
+            {
+                MPI_Allreduce(&local_change, &global_change, 1, MPI_DOUBLE,
+                              MPI_MAX, d->comm);
+                converged = global_change <= precision;
+                num_checks++;
+                if (halo_codec_update(d, global_change, precision))
+                {
+                    converged = false;
+                    encoded_iterations = iterations;
+                }
+            }
+            else if (!converged)
+            {
+                // Overlap the reduction with the sweeps up to the next check
+                if (check != MPI_REQUEST_NULL)
+                    MPI_Start(&check);
+                else
+                    MPI_Iallreduce(&local_change, &global_change, 1,
+                                   MPI_DOUBLE, MPI_MAX, d->comm, &check);
+                reducing = true;
+            }
+            next_check = iterations + (interval > 0 ? interval : 1);
+        }
+
+        if (next_rebalance > 0 && iterations >= next_rebalance && !converged)
+        {
+            domain_rebalance(d, sweep_time, log_level);
+            d->nonblocking = options->overlap;
+            d->pool = options->pool;
+            sweep_time = 0;
+            // The moved blocks are swept again before being left alone
+            quiet_change = INFINITY;
+            next_rebalance = iterations + options->rebalance_interval;
+        }
+
+        if (log_level <= LOG_DEBUG)
+        {
+            domain_gather(d, matrix);
+            if (rank == 0)
+            {
+                printf("Finished iteration %d \n", iterations);
+                print_matrix(matrix, d->size);
+            }
         }
     }
 
-    if (log_level <= LOG_DEBUG)
-        printf("Freeing memory \n");
+    if (log_level <= LOG_INFO)
+    {
+        // Report the communication time of the average process
+        int num_processes;
+        MPI_Comm_size(d->comm, &num_processes);
+        double times[2] = {exposed_time, hidden_time};
+        double total_times[2];
+        MPI_Reduce(times, total_times, 2, MPI_DOUBLE, MPI_SUM, 0, d->comm);
+        int counts[2] = {skipped_sweeps, quiet_exchanges};
+        int total_counts[2];
+        if (options->active_set)
+            MPI_Reduce(counts, total_counts, 2, MPI_INT, MPI_SUM, 0, d->comm);
+        if (rank == 0)
+        {
+            double exposed = total_times[0] / num_processes;
+            double hidden = total_times[1] / num_processes;
+            printf("Halo exchange: %fs exposed, %fs hidden (%.1f%%) \n",
+                   exposed, hidden,
+                   exposed + hidden > 0
+                       ? 100 * hidden / (exposed + hidden)
+                       : 0);
+            printf("Checked convergence %d times in %d iterations \n",
+                   num_checks, iterations);
+            if (options->halo_codec != HALO_CODEC_NONE)
+                printf("Encoded ghost cells for %d iterations \n",
+                       encoded_iterations);
+            if (options->active_set)
+                printf("Left blocks alone for %d of %d sweeps, sending no "
+                       "edges on %d of %d exchanges \n",
+                       total_counts[0], iterations * num_processes,
+                       total_counts[1], iterations * num_processes);
+        }
+    }
 
-    // Free the memory before exiting the program
-    free(scatter_displ);
-    free(scatter_count);
-    free(gather_displ);
-    free(gather_count);
-    free(send_buffer);
-    free(recv_buffer);
+    if (check != MPI_REQUEST_NULL)
+        MPI_Request_free(&check);
+    if (d->persistent)
+        halo_persistent_free(d);
+    if (d->rma_windows[0] != MPI_WIN_NULL)
+        halo_rma_free(d);
+    if (d->neighbour_comm != MPI_COMM_NULL)
+        halo_neighbour_free(d);
+    halo_codec_free(d);
+    active_set_free(d);
+    free(matrix);
+
+    return iterations;
 }
 
-void relax_cells(double *input, double *result, bool *precision_reached,
-                 size_t size, size_t input_size, double precision)
+double relax_cells(double *input, double *result, size_t rows,
+                   size_t columns, size_t stride)
 {
-    // Offset for the first working row - skip the first row
-    int start = size;
-    // Offset for the last working row - skip the last row
-    int end = input_size - size - 1;
-    int result_index = 0;
-
-    *precision_reached = true;
-    for (int input_index = start; input_index <= end; input_index++)
+    double largest_change = 0;
+    for (size_t i = 0; i < rows; i++)
     {
-        // If the cell is on the edge, skip it
-        if (input_index % size == 0 || (input_index + 1) % size == 0)
-        {
-            result[result_index] = input[input_index];
-        }
-        else
+        for (size_t j = 0; j < columns; j++)
         {
+            size_t index = i * stride + j;
+
             // Relax the cell
-            double new_value = (input[input_index - size] +
-                                input[input_index + size] +
-                                input[input_index - 1] +
-                                input[input_index + 1]) /
+            double new_value = (input[index - stride] +
+                                input[index + stride] +
+                                input[index - 1] +
+                                input[index + 1]) /
                                4;
-            result[result_index] = new_value;
+            result[index] = new_value;
+
+            // Track the change of that cell
+            double change = fabs(new_value - input[index]);
+            if (change > largest_change)
+                largest_change = change;
+        }
+    }
+
+    return largest_change;
+}
+
+bool choose_process_grid(int num_processes, size_t size, int dims[2])
+{
+    size_t inner = size - 2;
+    size_t best_halo = SIZE_MAX;
+    for (int rows = 1; rows <= num_processes; rows++)
+    {
+        if (num_processes % rows != 0)
+            continue;
+        int columns = num_processes / rows;
+        if (rows > inner || columns > inner)
+            continue;
 
-            // Check the precision on that cell. Short circuit if possible
-            if (*precision_reached &&
-                fabs(new_value - input[input_index]) > precision)
-                *precision_reached = false;
+        // The largest block decides how long every iteration waits
+        size_t block_rows = (inner + rows - 1) / rows;
+        size_t block_columns = (inner + columns - 1) / columns;
+        size_t halo = 2 * (block_rows + block_columns);
+        if (halo < best_halo)
+        {
+            best_halo = halo;
+            dims[0] = rows;
+            dims[1] = columns;
         }
+    }
+
+    return best_halo != SIZE_MAX;
+}
+
+bool problem_fits(int num_processes, size_t size, int halo_width)
+{
+    int dims[2];
+    if (!choose_process_grid(num_processes, size, dims))
+        return false;
+    return halo_width == 1 || ((size_t)halo_width <= (size - 2) / dims[0] &&
+                               (size_t)halo_width <= (size - 2) / dims[1]);
+}
+
+void problem_create(domain *d, MPI_Comm comm, size_t size, int halo_width,
+                    bool reorder, enum log_level log_level)
+{
+    if (reorder)
+    {
+        MPI_Comm reordered = reorder_by_node(comm, size, log_level);
+        domain_create(d, size, halo_width, reordered);
+        MPI_Comm_free(&reordered);
+    }
+    else
+        domain_create(d, size, halo_width, comm);
+    domain_init(d, size);
+
+    if (log_level <= LOG_INFO)
+    {
+        int rank;
+        MPI_Comm_rank(comm, &rank);
+        uint64_t bytes[2];
+        domain_locality(d, bytes);
+        if (rank == 0)
+            printf("Halo bytes per exchange: %" PRIu64 " within nodes, "
+                   "%" PRIu64 " between nodes \n",
+                   bytes[0], bytes[1]);
+    }
+}
+
+int ensemble_read(const char *path, uint64_t **sizes, double **precisions)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Could not open %s \n", path);
+        return -1;
+    }
+
+    int num_jobs = 0, capacity = 16, line_number = 0;
+    *sizes = malloc(capacity * sizeof(uint64_t));
+    *precisions = malloc(capacity * sizeof(double));
+    char line[256];
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        line_number++;
+        char *start = line + strspn(line, " \t");
+        if (*start == '#' || *start == '\n' || *start == '\0')
+            continue;
 
-        result_index++;
+        unsigned long long size;
+        double precision;
+        if (sscanf(start, "%llu %lf", &size, &precision) != 2 || size < 3 ||
+            size > 10e6 || precision <= 0)
+        {
+            fprintf(stderr, "Invalid job on line %d of %s \n", line_number,
+                    path);
+            fclose(file);
+            return -1;
+        }
+
+        if (num_jobs == capacity)
+        {
+            capacity *= 2;
+            *sizes = realloc(*sizes, capacity * sizeof(uint64_t));
+            *precisions = realloc(*precisions, capacity * sizeof(double));
+        }
+        (*sizes)[num_jobs] = size;
+        (*precisions)[num_jobs] = precision;
+        num_jobs++;
+    }
+    fclose(file);
+
+    if (num_jobs == 0)
+    {
+        fprintf(stderr, "No jobs in %s \n", path);
+        return -1;
+    }
+    return num_jobs;
+}
+
+int ensemble_schedule(const uint64_t *sizes, int num_jobs, int num_processes,
+                      int halo_width, int *groups, int *group_sizes)
+{
+    /* The sweeps needed grow with the square of the cells along a side, so
+    the work of a problem grows with the fourth power of its size */
+    double *costs = malloc(num_jobs * sizeof(double));
+    for (int job = 0; job < num_jobs; job++)
+        costs[job] = pow((double)(sizes[job] - 2), 4);
+
+    // Hand the costliest remaining job to the group with the least work
+    int num_groups = num_jobs < num_processes ? num_jobs : num_processes;
+    double *loads = calloc(num_groups, sizeof(double));
+    uint64_t *smallest = malloc(num_groups * sizeof(uint64_t));
+    bool *assigned = calloc(num_jobs, sizeof(bool));
+    for (int group = 0; group < num_groups; group++)
+        smallest[group] = UINT64_MAX;
+    for (int k = 0; k < num_jobs; k++)
+    {
+        int job = -1;
+        for (int other = 0; other < num_jobs; other++)
+            if (!assigned[other] && (job < 0 || costs[other] > costs[job]))
+                job = other;
+        int group = 0;
+        for (int other = 1; other < num_groups; other++)
+            if (loads[other] < loads[group])
+                group = other;
+
+        assigned[job] = true;
+        groups[job] = group;
+        loads[group] += costs[job];
+        if (sizes[job] < smallest[group])
+            smallest[group] = sizes[job];
+    }
+
+    /* Start every group on one process, then give each spare process to the
+    group with the most work per process whose smallest problem can still be
+    split further */
+    for (int group = 0; group < num_groups; group++)
+        group_sizes[group] = 1;
+    for (int spare = num_processes - num_groups; spare > 0; spare--)
+    {
+        int best = -1;
+        for (int group = 0; group < num_groups; group++)
+            if (problem_fits(group_sizes[group] + 1, smallest[group],
+                             halo_width) &&
+                (best < 0 || loads[group] / group_sizes[group] >
+                                 loads[best] / group_sizes[best]))
+                best = group;
+        if (best < 0)
+            break;
+        group_sizes[best]++;
+    }
+
+    /* Every job of a group is split over the grid of the whole group, so
+    give up processes until each one has blocks wide enough for its ghost
+    rings, leaving the rest idle */
+    bool fits = true;
+    for (int group = 0; group < num_groups && fits; group++)
+        for (int job = 0; job < num_jobs; job++)
+        {
+            if (groups[job] != group ||
+                problem_fits(group_sizes[group], sizes[job], halo_width))
+                continue;
+            if (group_sizes[group] == 1)
+            {
+                fits = false;
+                break;
+            }
+            // Check the earlier jobs of the group again on the smaller grid
+            group_sizes[group]--;
+            job = -1;
+        }
+
+    free(costs);
+    free(loads);
+    free(smallest);
+    free(assigned);
+    return fits ? num_groups : -1;
+}
+
+bool ensemble_run(const char *path, const solver_options *options,
+                  int levels, int halo_width, bool reorder)
+{
+    int rank, num_processes;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &num_processes);
+
+    // The root process reads the jobs for everyone
+    int num_jobs = -1;
+    uint64_t *sizes = NULL;
+    double *precisions = NULL;
+    if (rank == 0)
+        num_jobs = ensemble_read(path, &sizes, &precisions);
+    MPI_Bcast(&num_jobs, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (num_jobs < 0)
+    {
+        free(sizes);
+        free(precisions);
+        return false;
+    }
+    if (rank != 0)
+    {
+        sizes = malloc(num_jobs * sizeof(uint64_t));
+        precisions = malloc(num_jobs * sizeof(double));
+    }
+    MPI_Bcast(sizes, num_jobs, MPI_UINT64_T, 0, MPI_COMM_WORLD);
+    MPI_Bcast(precisions, num_jobs, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+
+    // Every process works out the same schedule
+    int *groups = malloc(num_jobs * sizeof(int));
+    int *group_sizes = malloc(num_processes * sizeof(int));
+    int num_groups = ensemble_schedule(sizes, num_jobs, num_processes,
+                                       halo_width, groups, group_sizes);
+    if (num_groups < 0)
+    {
+        if (rank == 0)
+            fprintf(stderr, "Halo width cannot be larger than the smallest "
+                            "block of the matrix of a job\n");
+        free(sizes);
+        free(precisions);
+        free(groups);
+        free(group_sizes);
+        return false;
+    }
+
+    // Consecutive ranks form each group, so small groups stay within a node
+    int colour = MPI_UNDEFINED;
+    int first_rank = 0;
+    for (int group = 0; group < num_groups; group++)
+    {
+        if (rank >= first_rank && rank < first_rank + group_sizes[group])
+            colour = group;
+        first_rank += group_sizes[group];
+    }
+    MPI_Comm comm;
+    MPI_Comm_split(MPI_COMM_WORLD, colour, rank, &comm);
+
+    // Only the root of each group fills in the outcome of its jobs
+    int *iterations = calloc(num_jobs, sizeof(int));
+    int *levels_used = calloc(num_jobs, sizeof(int));
+    double *times = calloc(num_jobs, sizeof(double));
+    if (comm != MPI_COMM_NULL)
+    {
+        int group_rank;
+        MPI_Comm_rank(comm, &group_rank);
+        for (int job = 0; job < num_jobs; job++)
+        {
+            if (groups[job] != colour)
+                continue;
+
+            solver_options job_options = *options;
+            job_options.precision = precisions[job];
+            int job_levels = levels;
+            double start = MPI_Wtime();
+
+            domain d;
+            problem_create(&d, comm, sizes[job], halo_width, reorder,
+                           options->log_level);
+            int job_iterations = relax_matrix_nested(&d, &job_options,
+                                                     &job_levels);
+            domain_destroy(&d);
+
+            if (group_rank == 0)
+            {
+                iterations[job] = job_iterations;
+                levels_used[job] = job_levels;
+                times[job] = MPI_Wtime() - start;
+            }
+        }
+        MPI_Comm_free(&comm);
+    }
+
+    // Collect every outcome on the root process
+    MPI_Reduce(rank == 0 ? MPI_IN_PLACE : iterations, iterations, num_jobs,
+               MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Reduce(rank == 0 ? MPI_IN_PLACE : levels_used, levels_used, num_jobs,
+               MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Reduce(rank == 0 ? MPI_IN_PLACE : times, times, num_jobs, MPI_DOUBLE,
+               MPI_SUM, 0, MPI_COMM_WORLD);
+    if (rank == 0)
+    {
+        int idle = num_processes - first_rank;
+        printf("Solved %d jobs on %d groups of processes, %d idle \n",
+               num_jobs, num_groups, idle);
+        for (int job = 0; job < num_jobs; job++)
+            printf("Job %d: size %" PRIu64 ", precision %g, %d processes, "
+                   "%d iterations using %d levels in %fs \n",
+                   job, sizes[job], precisions[job],
+                   group_sizes[groups[job]], iterations[job],
+                   levels_used[job], times[job]);
+    }
+
+    free(sizes);
+    free(precisions);
+    free(groups);
+    free(group_sizes);
+    free(iterations);
+    free(levels_used);
+    free(times);
+    return true;
+}
+
+MPI_Comm reorder_by_node(MPI_Comm comm, size_t size,
+                         enum log_level log_level)
+{
+    int rank, num_processes;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &num_processes);
+    int dims[2];
+    choose_process_grid(num_processes, size, dims);
+
+    // Number the nodes by the order of their first processes
+    MPI_Comm node_comm, leaders;
+    MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL,
+                        &node_comm);
+    int node_rank, node_size, node = 0;
+    MPI_Comm_rank(node_comm, &node_rank);
+    MPI_Comm_size(node_comm, &node_size);
+    MPI_Comm_split(comm, node_rank == 0 ? 0 : MPI_UNDEFINED, rank, &leaders);
+    if (leaders != MPI_COMM_NULL)
+    {
+        MPI_Comm_rank(leaders, &node);
+        MPI_Comm_free(&leaders);
+    }
+    MPI_Bcast(&node, 1, MPI_INT, 0, node_comm);
+    MPI_Comm_free(&node_comm);
+
+    /* Choose the tile of blocks per node with the fewest cells along its
+    sides, which needs every node to hold the same number of processes */
+    int sizes[2] = {node_size, -node_size};
+    MPI_Allreduce(MPI_IN_PLACE, sizes, 2, MPI_INT, MPI_MAX, comm);
+    double block[2] = {(double)(size - 2) / dims[0],
+                       (double)(size - 2) / dims[1]};
+    int tile[2] = {0, 0};
+    if (sizes[0] == -sizes[1])
+        for (int rows = 1; rows <= node_size; rows++)
+        {
+            int columns = node_size / rows;
+            if (node_size % rows != 0 || dims[0] % rows != 0 ||
+                dims[1] % columns != 0)
+                continue;
+            if (tile[0] == 0 || rows * block[0] + columns * block[1] <
+                                    tile[0] * block[0] + tile[1] * block[1])
+            {
+                tile[0] = rows;
+                tile[1] = columns;
+            }
+        }
+
+    // Without a tile, keep the nodes in consecutive runs of the grid
+    int key = rank;
+    if (tile[0] > 0)
+    {
+        int index = node * node_size + node_rank;
+        int position = index / node_size;
+        int tiles_per_row = dims[1] / tile[1];
+        int row = position / tiles_per_row * tile[0] +
+                  node_rank / tile[1];
+        int column = position % tiles_per_row * tile[1] +
+                     node_rank % tile[1];
+        key = row * dims[1] + column;
+    }
+    if (rank == 0 && log_level <= LOG_INFO)
+    {
+        if (tile[0] > 0)
+            printf("Placing a %d x %d tile of blocks on each node \n",
+                   tile[0], tile[1]);
+        else
+            printf("Nodes cannot be tiled over the %d x %d process grid, "
+                   "keeping the rank order \n",
+                   dims[0], dims[1]);
+    }
+
+    MPI_Comm reordered;
+    MPI_Comm_split(comm, 0, key, &reordered);
+    return reordered;
+}
+
+void domain_create(domain *d, size_t size, size_t halo_width, MPI_Comm comm)
+{
+    int num_processes, rank;
+    MPI_Comm_size(comm, &num_processes);
+    choose_process_grid(num_processes, size, d->dims);
+
+    // Neighbouring blocks are not wrapped around the matrix
+    int periods[2] = {0, 0};
+    MPI_Cart_create(comm, 2, d->dims, periods, 0, &d->comm);
+    MPI_Comm_rank(d->comm, &rank);
+    MPI_Cart_coords(d->comm, rank, 2, d->coords);
+
+    // Spread the remainder of the inner rows and columns over the first blocks
+    size_t inner = size - 2;
+    size_t *starts[2];
+    for (int axis = 0; axis < 2; axis++)
+    {
+        starts[axis] = malloc((d->dims[axis] + 1) * sizeof(size_t));
+        size_t per_block = inner / d->dims[axis];
+        size_t remainder = inner % d->dims[axis];
+        starts[axis][0] = 1;
+        for (int k = 0; k < d->dims[axis]; k++)
+            starts[axis][k + 1] = starts[axis][k] + per_block +
+                                  ((size_t)k < remainder ? 1 : 0);
+    }
+    d->row_starts = starts[0];
+    d->column_starts = starts[1];
+    d->size = size;
+    d->halo_width = halo_width;
+
+    domain_layout(d);
+}
+
+bool domain_coarsen(domain *coarse, const domain *fine, size_t size)
+{
+    /* Start each coarse block at the first coarse row or column at or after
+    the start of the fine block, so every fine cell lies between the coarse
+    cells of the same block and its ghost ring */
+    size_t *fine_starts[2] = {fine->row_starts, fine->column_starts};
+    size_t *starts[2];
+    for (int axis = 0; axis < 2; axis++)
+    {
+        starts[axis] = malloc((fine->dims[axis] + 1) * sizeof(size_t));
+        for (int k = 0; k <= fine->dims[axis]; k++)
+            starts[axis][k] = (fine_starts[axis][k] * (size - 1) +
+                               fine->size - 2) /
+                              (fine->size - 1);
+    }
+
+    // Every coarse block needs at least one cell
+    bool valid = true;
+    for (int axis = 0; axis < 2; axis++)
+        for (int k = 0; k < fine->dims[axis]; k++)
+            if (starts[axis][k + 1] <= starts[axis][k])
+                valid = false;
+    if (!valid)
+    {
+        free(starts[0]);
+        free(starts[1]);
+        return false;
+    }
+
+    // Duplicating the communicator keeps its cartesian topology
+    MPI_Comm_dup(fine->comm, &coarse->comm);
+    coarse->dims[0] = fine->dims[0];
+    coarse->dims[1] = fine->dims[1];
+    coarse->coords[0] = fine->coords[0];
+    coarse->coords[1] = fine->coords[1];
+    coarse->row_starts = starts[0];
+    coarse->column_starts = starts[1];
+    coarse->size = size;
+    coarse->halo_width = 1;
+
+    domain_layout(coarse);
+    return true;
+}
+
+void domain_rebalance(domain *d, double sweep_time, enum log_level log_level)
+{
+    int rank, num_processes;
+    MPI_Comm_rank(d->comm, &rank);
+    MPI_Comm_size(d->comm, &num_processes);
+
+    // The slowest block of each row and column of blocks holds up the rest
+    double *times = malloc(num_processes * sizeof(double));
+    MPI_Allgather(&sweep_time, 1, MPI_DOUBLE, times, 1, MPI_DOUBLE, d->comm);
+    double *axis_times[2] = {calloc(d->dims[0], sizeof(double)),
+                             calloc(d->dims[1], sizeof(double))};
+    for (int p = 0; p < num_processes; p++)
+    {
+        int coords[2];
+        MPI_Cart_coords(d->comm, p, 2, coords);
+        for (int axis = 0; axis < 2; axis++)
+            axis_times[axis][coords[axis]] =
+                fmax(axis_times[axis][coords[axis]], times[p]);
+    }
+    free(times);
+
+    domain e = *d;
+    e.row_starts = balance_starts(d->row_starts, axis_times[0], d->dims[0],
+                                  d->halo_width);
+    e.column_starts = balance_starts(d->column_starts, axis_times[1],
+                                     d->dims[1], d->halo_width);
+    free(axis_times[0]);
+    free(axis_times[1]);
+
+    bool moved = false;
+    for (int k = 0; k <= d->dims[0]; k++)
+        moved |= e.row_starts[k] != d->row_starts[k];
+    for (int k = 0; k <= d->dims[1]; k++)
+        moved |= e.column_starts[k] != d->column_starts[k];
+    if (!moved)
+    {
+        free(e.row_starts);
+        free(e.column_starts);
+        return;
+    }
+
+    // The new blocks take the fixed boundary from the problem itself
+    domain_layout(&e);
+    domain_init(&e, d->source_size);
+
+    domain_redistribute(d, &e);
+
+    if (rank == 0 && log_level <= LOG_INFO)
+    {
+        printf("Rebalanced blocks to start at rows");
+        for (int k = 0; k < d->dims[0]; k++)
+            printf(" %zu", e.row_starts[k]);
+        printf(" and columns");
+        for (int k = 0; k < d->dims[1]; k++)
+            printf(" %zu", e.column_starts[k]);
+        printf(" \n");
+    }
+
+    // The communicator, and any reduction pending on it, carries over
+    enum halo_codec codec = d->codec;
+    halo_codec_free(d);
+    bool active_set = d->active_set;
+    active_set_free(d);
+    MPI_Type_free(&d->halo_types[DIRECTION_UP]);
+    MPI_Type_free(&d->halo_types[DIRECTION_LEFT]);
+    free(d->row_starts);
+    free(d->column_starts);
+    free(d->cells);
+    free(d->next);
+    *d = e;
+    if (codec != HALO_CODEC_NONE)
+        halo_codec_init(d, codec);
+    if (active_set)
+        active_set_init(d);
+}
+
+void domain_redistribute(const domain *from, domain *to)
+{
+    /* Send each process the part of this block that lies in its new block,
+    receiving the parts of the new block of this process from their owners */
+    int num_processes;
+    MPI_Comm_size(from->comm, &num_processes);
+    int *counts = malloc(2 * num_processes * sizeof(int));
+    int *displacements = calloc(2 * num_processes, sizeof(int));
+    MPI_Datatype *types = malloc(2 * num_processes * sizeof(MPI_Datatype));
+    for (int p = 0; p < num_processes; p++)
+    {
+        size_t old_starts[2], old_counts[2], new_starts[2], new_counts[2];
+        domain_block(from, p, old_starts, old_counts);
+        domain_block(to, p, new_starts, new_counts);
+        for (int side = 0; side < 2; side++)
+        {
+            // Sending from the old block of this process to the new block of
+            // process p, or receiving from the old block of p into the new
+            // block of this process
+            const domain *local = side == 0 ? from : to;
+            size_t *other = side == 0 ? new_starts : old_starts;
+            size_t *other_counts = side == 0 ? new_counts : old_counts;
+            size_t local_starts[2] = {local->first_row, local->first_column};
+            size_t local_counts[2] = {local->rows, local->columns};
+
+            size_t first[2], overlap[2];
+            bool empty = false;
+            for (int axis = 0; axis < 2; axis++)
+            {
+                size_t end = local_starts[axis] + local_counts[axis];
+                size_t other_end = other[axis] + other_counts[axis];
+                first[axis] = other[axis] > local_starts[axis]
+                                  ? other[axis]
+                                  : local_starts[axis];
+                size_t last = end < other_end ? end : other_end;
+                overlap[axis] = last > first[axis] ? last - first[axis] : 0;
+                empty |= overlap[axis] == 0;
+            }
+
+            int index = side * num_processes + p;
+            if (empty)
+            {
+                counts[index] = 0;
+                types[index] = MPI_DOUBLE;
+                continue;
+            }
+
+            size_t sizes[2] = {local->rows + 2 * local->halo_width,
+                               local->stride};
+            size_t offsets[2] = {
+                first[0] - local_starts[0] + local->halo_width,
+                first[1] - local_starts[1] + local->halo_width};
+            type_rectangle(sizes, overlap, offsets, &types[index]);
+            counts[index] = 1;
+        }
+    }
+    MPI_Alltoallw(from->cells, counts, displacements, types, to->cells,
+                  counts + num_processes, displacements + num_processes,
+                  types + num_processes, from->comm);
+    for (int index = 0; index < 2 * num_processes; index++)
+        if (counts[index] > 0)
+            MPI_Type_free(&types[index]);
+    free(counts);
+    free(displacements);
+    free(types);
+    memcpy(to->next, to->cells, to->length * sizeof(double));
+}
+
+size_t *balance_starts(const size_t *starts, const double *times, int count,
+                       size_t minimum)
+{
+    size_t *result = malloc((count + 1) * sizeof(size_t));
+    double *speeds = malloc(count * sizeof(double));
+    double total_speed = 0;
+    for (int k = 0; k < count; k++)
+    {
+        // Without a measurement, assume the part is as fast as it is big
+        size_t length = starts[k + 1] - starts[k];
+        speeds[k] = times[k] > 0 ? length / times[k] : length;
+        total_speed += speeds[k];
+    }
+
+    size_t length = starts[count] - starts[0];
+    double speed = 0;
+    result[0] = starts[0];
+    for (int k = 1; k < count; k++)
+    {
+        speed += speeds[k - 1];
+        size_t start = starts[0] + (size_t)(length * speed / total_speed + 0.5);
+
+        // Leave every part at least the minimum size
+        if (start < result[k - 1] + minimum)
+            start = result[k - 1] + minimum;
+        if (start > starts[count] - (count - k) * minimum)
+            start = starts[count] - (count - k) * minimum;
+        result[k] = start;
+    }
+    result[count] = starts[count];
+
+    free(speeds);
+    return result;
+}
+
+void domain_layout(domain *d)
+{
+    d->first_row = d->row_starts[d->coords[0]];
+    d->rows = d->row_starts[d->coords[0] + 1] - d->first_row;
+    d->first_column = d->column_starts[d->coords[1]];
+    d->columns = d->column_starts[d->coords[1] + 1] - d->first_column;
+    size_t width = d->halo_width;
+    d->stride = d->columns + 2 * width;
+    d->length = (d->rows + 2 * width) * d->stride;
+    d->first_cell = width * d->stride + width;
+
+    d->cells = calloc(d->length, sizeof(double));
+    d->next = calloc(d->length, sizeof(double));
+    d->cell_arrays[0] = d->cells;
+    d->cell_arrays[1] = d->next;
+    d->pool = NULL;
+    d->nonblocking = false;
+    d->num_requests = 0;
+    d->persistent = false;
+    d->shared_window = MPI_WIN_NULL;
+    d->rma_windows[0] = MPI_WIN_NULL;
+    d->neighbour_comm = MPI_COMM_NULL;
+    d->rma_windows[1] = MPI_WIN_NULL;
+
+    MPI_Cart_shift(d->comm, 0, 1, &d->neighbours[DIRECTION_UP],
+                   &d->neighbours[DIRECTION_DOWN]);
+    MPI_Cart_shift(d->comm, 1, 1, &d->neighbours[DIRECTION_LEFT],
+                   &d->neighbours[DIRECTION_RIGHT]);
+    for (int direction = 0; direction < NUM_DIRECTIONS; direction++)
+        d->message_neighbours[direction] = d->neighbours[direction];
+
+    /* Rows are contiguous, columns are strided by the row length. Deep
+    columns also span the ghost rows, which are exchanged first, so the
+    corners reach the diagonal neighbours through two exchanges */
+    size_t column_rows = width > 1 ? d->rows + 2 * width : d->rows;
+    size_t top = width > 1 ? 0 : d->first_cell - width;
+    type_rows(width, d->columns, d->stride, &d->halo_types[DIRECTION_UP]);
+    type_rows(column_rows, width, d->stride, &d->halo_types[DIRECTION_LEFT]);
+    d->halo_types[DIRECTION_DOWN] = d->halo_types[DIRECTION_UP];
+    d->halo_types[DIRECTION_RIGHT] = d->halo_types[DIRECTION_LEFT];
+    for (int direction = 0; direction < NUM_DIRECTIONS; direction++)
+    {
+        bool row = direction == DIRECTION_UP || direction == DIRECTION_DOWN;
+        d->halo_rows[direction] = row ? width : column_rows;
+        d->halo_columns[direction] = row ? d->columns : width;
+        d->codec_sends[direction] = NULL;
+        d->codec_receives[direction] = NULL;
+        d->active_ghosts[direction] = NULL;
+    }
+    d->codec = HALO_CODEC_NONE;
+    d->active_set = false;
+
+    d->edge_offsets[DIRECTION_UP] = d->first_cell;
+    d->edge_offsets[DIRECTION_DOWN] =
+        d->first_cell + (d->rows - width) * d->stride;
+    d->edge_offsets[DIRECTION_LEFT] = top + width;
+    d->edge_offsets[DIRECTION_RIGHT] = top + d->columns;
+    d->ghost_offsets[DIRECTION_UP] = width;
+    d->ghost_offsets[DIRECTION_DOWN] = d->first_cell + d->rows * d->stride;
+    d->ghost_offsets[DIRECTION_LEFT] = top;
+    d->ghost_offsets[DIRECTION_RIGHT] = top + width + d->columns;
+}
+
+void domain_destroy(domain *d)
+{
+    MPI_Type_free(&d->halo_types[DIRECTION_UP]);
+    MPI_Type_free(&d->halo_types[DIRECTION_LEFT]);
+    MPI_Comm_free(&d->comm);
+    free(d->row_starts);
+    free(d->column_starts);
+    if (d->shared_window != MPI_WIN_NULL)
+    {
+        MPI_Win_unlock_all(d->shared_window);
+        MPI_Win_free(&d->shared_window);
+        MPI_Comm_free(&d->node_comm);
+        return;
+    }
+    free(d->cells);
+    free(d->next);
+}
+
+void domain_locality(const domain *d, uint64_t bytes[2])
+{
+    // Tell the processes apart by the first process on their node
+    int rank, num_processes;
+    MPI_Comm_rank(d->comm, &rank);
+    MPI_Comm_size(d->comm, &num_processes);
+    MPI_Comm node_comm;
+    MPI_Comm_split_type(d->comm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL,
+                        &node_comm);
+    int node = rank;
+    MPI_Bcast(&node, 1, MPI_INT, 0, node_comm);
+    MPI_Comm_free(&node_comm);
+    int *nodes = malloc(num_processes * sizeof(int));
+    MPI_Allgather(&node, 1, MPI_INT, nodes, 1, MPI_INT, d->comm);
+
+    bytes[0] = 0;
+    bytes[1] = 0;
+    for (int direction = 0; direction < NUM_DIRECTIONS; direction++)
+    {
+        int neighbour = d->neighbours[direction];
+        if (neighbour == MPI_PROC_NULL)
+            continue;
+        uint64_t sent = d->halo_rows[direction] * d->halo_columns[direction] *
+                        sizeof(double);
+        bytes[nodes[neighbour] == node ? 0 : 1] += sent;
+    }
+    free(nodes);
+    MPI_Allreduce(MPI_IN_PLACE, bytes, 2, MPI_UINT64_T, MPI_SUM, d->comm);
+}
+
+void domain_block(const domain *d, int rank, size_t starts[2],
+                  size_t counts[2])
+{
+    int coords[2];
+    MPI_Cart_coords(d->comm, rank, 2, coords);
+    starts[0] = d->row_starts[coords[0]];
+    counts[0] = d->row_starts[coords[0] + 1] - starts[0];
+    starts[1] = d->column_starts[coords[1]];
+    counts[1] = d->column_starts[coords[1] + 1] - starts[1];
+}
+
+void type_rows(size_t rows, size_t columns, size_t stride,
+               MPI_Datatype *type)
+{
+#if MPI_VERSION >= 4
+    MPI_Type_vector_c(rows, columns, stride, MPI_DOUBLE, type);
+#else
+    MPI_Type_vector(rows, columns, stride, MPI_DOUBLE, type);
+#endif
+    MPI_Type_commit(type);
+}
+
+void type_rectangle(const size_t sizes[2], const size_t counts[2],
+                    const size_t starts[2], MPI_Datatype *type)
+{
+#if MPI_VERSION >= 4
+    MPI_Count type_sizes[2] = {sizes[0], sizes[1]};
+    MPI_Count type_counts[2] = {counts[0], counts[1]};
+    MPI_Count type_starts[2] = {starts[0], starts[1]};
+    MPI_Type_create_subarray_c(2, type_sizes, type_counts, type_starts,
+                               MPI_ORDER_C, MPI_DOUBLE, type);
+#else
+    int type_sizes[2] = {sizes[0], sizes[1]};
+    int type_counts[2] = {counts[0], counts[1]};
+    int type_starts[2] = {starts[0], starts[1]};
+    MPI_Type_create_subarray(2, type_sizes, type_counts, type_starts,
+                             MPI_ORDER_C, MPI_DOUBLE, type);
+#endif
+    MPI_Type_commit(type);
+}
+
+void domain_init(domain *d, size_t source_size)
+{
+    d->source_size = source_size;
+
+    /* Sample the problem at every cell of the block and its ghost rings
+    that lies inside the matrix, as deep rings also hold the fixed boundary
+    beside the edges of the neighbours */
+    size_t width = d->halo_width;
+    double scale = (double)(source_size - 1) / (d->size - 1);
+    for (size_t r = 0; r < d->rows + 2 * width; r++)
+    {
+        size_t i = d->first_row + r - width;
+        if (d->first_row + r < width || i >= d->size)
+            continue;
+        double x = i * scale;
+        size_t i0 = x < source_size - 1 ? (size_t)x : source_size - 2;
+        double di = x - i0;
+        for (size_t c = 0; c < d->columns + 2 * width; c++)
+        {
+            size_t j = d->first_column + c - width;
+            if (d->first_column + c < width || j >= d->size)
+                continue;
+            double y = j * scale;
+            size_t j0 = y < source_size - 1 ? (size_t)y : source_size - 2;
+            double dj = y - j0;
+            d->cells[r * d->stride + c] =
+                (1 - di) * (1 - dj) * matrix_value(source_size, i0, j0) +
+                (1 - di) * dj * matrix_value(source_size, i0, j0 + 1) +
+                di * (1 - dj) * matrix_value(source_size, i0 + 1, j0) +
+                di * dj * matrix_value(source_size, i0 + 1, j0 + 1);
+        }
+    }
+}
+
+void domain_interpolate(const domain *coarse, domain *fine)
+{
+    double scale = (double)(coarse->size - 1) / (fine->size - 1);
+    double *coarse_ring = coarse->cells + coarse->first_cell -
+                          coarse->stride - 1;
+    double *fine_ring = fine->cells + fine->first_cell - fine->stride - 1;
+    for (size_t r = 1; r <= fine->rows; r++)
+    {
+        double x = (fine->first_row - 1 + r) * scale;
+        size_t i0 = x < coarse->size - 1 ? (size_t)x : coarse->size - 2;
+        double di = x - i0;
+        // The row of the coarse cells, counting the ghost row above
+        double *above =
+            coarse_ring + (i0 + 1 - coarse->first_row) * coarse->stride;
+        double *below = above + coarse->stride;
+        for (size_t c = 1; c <= fine->columns; c++)
+        {
+            double y = (fine->first_column - 1 + c) * scale;
+            size_t j0 = y < coarse->size - 1 ? (size_t)y : coarse->size - 2;
+            double dj = y - j0;
+            size_t k = j0 + 1 - coarse->first_column;
+            fine_ring[r * fine->stride + c] =
+                (1 - di) * (1 - dj) * above[k] +
+                (1 - di) * dj * above[k + 1] +
+                di * (1 - dj) * below[k] +
+                di * dj * below[k + 1];
+        }
+    }
+}
+
+void domain_gather(domain *d, double *matrix)
+{
+    int rank, num_processes;
+    MPI_Comm_rank(d->comm, &rank);
+    MPI_Comm_size(d->comm, &num_processes);
+
+    /* Send the owned cells without their ghost ring, in bands of rows small
+    enough for the byte counts of MPI libraries that keep them in an int */
+    size_t band = INT_MAX / (d->columns * sizeof(double));
+    if (band == 0)
+        band = 1;
+    size_t num_bands = (d->rows + band - 1) / band;
+    MPI_Request *requests = malloc(num_bands * sizeof(MPI_Request));
+    MPI_Datatype *owned = malloc(num_bands * sizeof(MPI_Datatype));
+    for (size_t k = 0; k < num_bands; k++)
+    {
+        size_t rows = d->rows - k * band < band ? d->rows - k * band : band;
+        type_rows(rows, d->columns, d->stride, &owned[k]);
+        MPI_Isend(d->cells + d->first_cell + k * band * d->stride, 1,
+                  owned[k], 0, 0, d->comm, &requests[k]);
+    }
+
+    if (rank == 0)
+    {
+        size_t sizes[2] = {d->size, d->size};
+        for (int p = 0; p < num_processes; p++)
+        {
+            size_t starts[2], counts[2];
+            domain_block(d, p, starts, counts);
+
+            // Messages between two processes arrive in the order sent
+            size_t block_band = INT_MAX / (counts[1] * sizeof(double));
+            if (block_band == 0)
+                block_band = 1;
+            size_t rows = counts[0];
+            while (rows > 0)
+            {
+                counts[0] = rows < block_band ? rows : block_band;
+                MPI_Datatype block;
+                type_rectangle(sizes, counts, starts, &block);
+                MPI_Recv(matrix, 1, block, p, 0, d->comm, MPI_STATUS_IGNORE);
+                MPI_Type_free(&block);
+                starts[0] += counts[0];
+                rows -= counts[0];
+            }
+        }
+    }
+
+    MPI_Waitall(num_bands, requests, MPI_STATUSES_IGNORE);
+    for (size_t k = 0; k < num_bands; k++)
+        MPI_Type_free(&owned[k]);
+    free(requests);
+    free(owned);
+}
+
+bool domain_write(domain *d, const char *path, int aggregators)
+{
+    int rank;
+    MPI_Comm_rank(d->comm, &rank);
+
+    MPI_Info info;
+    MPI_Info_create(&info);
+    if (aggregators > 0)
+    {
+        // Collective buffering funnels the writes through a few processes
+        char value[16];
+        snprintf(value, sizeof(value), "%d", aggregators);
+        MPI_Info_set(info, "cb_nodes", value);
+        MPI_Info_set(info, "romio_cb_write", "enable");
+    }
+
+    MPI_File file;
+    int err = MPI_File_open(d->comm, path, MPI_MODE_CREATE | MPI_MODE_WRONLY,
+                            info, &file);
+    MPI_Info_free(&info);
+    if (err != MPI_SUCCESS)
+    {
+        if (rank == 0)
+            fprintf(stderr, "Could not open %s for writing \n", path);
+        return false;
+    }
+    MPI_File_set_size(file, 0);
+
+    bool written = true;
+    if (rank == 0)
+    {
+        matrix_file_header header = {MATRIX_FILE_MAGIC, d->size, d->size,
+                                     sizeof(double)};
+        written = MPI_File_write_at(file, 0, &header, sizeof(header),
+                                    MPI_BYTE, MPI_STATUS_IGNORE) ==
+                  MPI_SUCCESS;
+    }
+
+    /* Blocks at the edge of the process grid also write the fixed boundary
+    held in their ghost ring */
+    size_t first[2] = {d->first_row, d->first_column};
+    size_t counts[2] = {d->rows, d->columns};
+    size_t local_first[2] = {d->halo_width, d->halo_width};
+    for (int axis = 0; axis < 2; axis++)
+    {
+        if (d->coords[axis] == 0)
+        {
+            first[axis]--;
+            local_first[axis]--;
+            counts[axis]++;
+        }
+        if (d->coords[axis] == d->dims[axis] - 1)
+            counts[axis]++;
+    }
+
+    size_t sizes[2] = {d->size, d->size};
+    MPI_Datatype block;
+    type_rectangle(sizes, counts, first, &block);
+
+    size_t local_sizes[2] = {d->rows + 2 * d->halo_width, d->stride};
+    MPI_Datatype local;
+    type_rectangle(local_sizes, counts, local_first, &local);
+
+    MPI_File_set_view(file, sizeof(matrix_file_header), MPI_DOUBLE, block,
+                      "native", MPI_INFO_NULL);
+    err = MPI_File_write_all(file, d->cells, 1, local, MPI_STATUS_IGNORE);
+    written = written && err == MPI_SUCCESS;
+
+    MPI_Type_free(&block);
+    MPI_Type_free(&local);
+    MPI_File_close(&file);
+
+    // Any process failing to write fails the whole matrix
+    MPI_Allreduce(MPI_IN_PLACE, &written, 1, MPI_C_BOOL, MPI_LAND, d->comm);
+    if (!written && rank == 0)
+        fprintf(stderr, "Could not write %s \n", path);
+    return written;
+}
+
+double relax_region(domain *d, size_t row, size_t column, size_t rows,
+                    size_t columns)
+{
+    size_t offset = d->first_cell + row * d->stride + column;
+    return relax_span(d, offset, rows, columns);
+}
+
+void relax_extended(domain *d, size_t rings)
+{
+    // The fixed boundary of the matrix is never relaxed
+    size_t up = d->neighbours[DIRECTION_UP] != MPI_PROC_NULL ? rings : 0;
+    size_t down = d->neighbours[DIRECTION_DOWN] != MPI_PROC_NULL ? rings : 0;
+    size_t left = d->neighbours[DIRECTION_LEFT] != MPI_PROC_NULL ? rings : 0;
+    size_t right =
+        d->neighbours[DIRECTION_RIGHT] != MPI_PROC_NULL ? rings : 0;
+
+    size_t offset = d->first_cell - up * d->stride - left;
+    relax_span(d, offset, d->rows + up + down, d->columns + left + right);
+}
+
+double relax_span(domain *d, size_t offset, size_t rows, size_t columns)
+{
+    thread_pool *pool = d->pool;
+    if (pool == NULL || rows < (size_t)pool->num_threads)
+        return relax_cells(d->cells + offset, d->next + offset, rows, columns,
+                           d->stride);
+
+    // Hand the rectangle to the workers, taking the first strip here
+    pool->d = d;
+    pool->offset = offset;
+    pool->rows = rows;
+    pool->columns = columns;
+    pthread_barrier_wait(&pool->start);
+    pool_relax_strip(pool, 0);
+    pthread_barrier_wait(&pool->finish);
+
+    double change = 0;
+    for (int id = 0; id < pool->num_threads; id++)
+        change = fmax(change, pool->changes[id]);
+    return change;
+}
+
+void halo_begin(domain *d)
+{
+    if (d->shared_window != MPI_WIN_NULL)
+    {
+        /* Wait for the neighbours on this node to finish the sweep, making
+        their cells visible here */
+        MPI_Win_sync(d->shared_window);
+        MPI_Barrier(d->node_comm);
+        MPI_Win_sync(d->shared_window);
+
+        // Both cell arrays are swapped in step on every process
+        int set = d->cells == d->cell_arrays[0] ? 0 : 1;
+        for (int direction = 0; direction < NUM_DIRECTIONS; direction++)
+        {
+            double *edge = d->shared_edges[set][direction];
+            if (edge == NULL)
+                continue;
+
+            double *ghost = d->cells + d->ghost_offsets[direction];
+            if (direction == DIRECTION_UP || direction == DIRECTION_DOWN)
+                memcpy(ghost, edge, d->columns * sizeof(double));
+            else
+                for (size_t k = 0; k < d->rows; k++)
+                    ghost[k * d->stride] = edge[k * d->shared_steps[direction]];
+        }
+    }
+
+    if (d->rma_windows[0] != MPI_WIN_NULL)
+    {
+        // Put into the window on the cell array current on every process
+        d->rma_set = d->cells == d->cell_arrays[0] ? 0 : 1;
+        MPI_Win window = d->rma_windows[d->rma_set];
+        if (d->rma_fence)
+            MPI_Win_fence(MPI_MODE_NOPRECEDE, window);
+        else
+        {
+            /* Expose the ghost ring to the neighbours, then access theirs.
+            The neighbours put into it and the last sweep stored into it, so
+            neither MPI_MODE_NOPUT nor MPI_MODE_NOSTORE holds */
+            MPI_Win_post(d->rma_group, 0, window);
+            MPI_Win_start(d->rma_group, 0, window);
+        }
+
+        for (int direction = 0; direction < NUM_DIRECTIONS; direction++)
+            if (d->neighbours[direction] != MPI_PROC_NULL)
+                MPI_Put(d->cells + d->edge_offsets[direction], 1,
+                        d->halo_types[direction], d->neighbours[direction],
+                        d->rma_displacements[direction], 1,
+                        d->rma_types[direction], window);
+        return;
+    }
+
+    if (d->neighbour_comm != MPI_COMM_NULL)
+    {
+        /* The edges are sent relative to the first owned cell, keeping the
+        send and receive buffers apart */
+        d->num_requests = 0;
+        double *edges = d->cells + d->first_cell;
+        if (d->nonblocking)
+            MPI_Ineighbor_alltoallw(
+                edges, d->neighbour_counts, d->neighbour_sends,
+                d->neighbour_types, d->cells, d->neighbour_counts,
+                d->neighbour_receives, d->neighbour_types, d->neighbour_comm,
+                &d->requests[d->num_requests++]);
+        else
+            MPI_Neighbor_alltoallw(edges, d->neighbour_counts,
+                                   d->neighbour_sends, d->neighbour_types,
+                                   d->cells, d->neighbour_counts,
+                                   d->neighbour_receives, d->neighbour_types,
+                                   d->neighbour_comm);
+        return;
+    }
+
+    if (d->persistent)
+    {
+        // Start the set of requests reading and writing the current cells
+        d->persistent_set = d->cells == d->cell_arrays[0] ? 0 : 1;
+        MPI_Startall(d->num_persistent_requests,
+                     d->persistent_requests[d->persistent_set]);
+        return;
+    }
+
+    /* Send the edge facing each direction to the neighbour there, receiving
+    the ghost cells on the opposite side from the neighbour there */
+    d->num_requests = 0;
+    for (int direction = 0; direction < NUM_DIRECTIONS; direction++)
+    {
+        int opposite = direction ^ 1;
+        double *edge = d->cells + d->edge_offsets[direction];
+        double *ghost = d->cells + d->ghost_offsets[opposite];
+
+        if (d->codec != HALO_CODEC_NONE)
+        {
+            // Only the encoded cells go on the wire
+            unsigned char *send = d->codec_sends[direction];
+            unsigned char *receive = d->codec_receives[opposite];
+            int send_bytes = halo_codec_bytes(d, direction);
+            int receive_bytes = halo_codec_bytes(d, opposite);
+            if (d->message_neighbours[direction] != MPI_PROC_NULL)
+                halo_encode(d, direction, send);
+
+            if (!d->nonblocking)
+            {
+                MPI_Sendrecv(send, send_bytes, MPI_BYTE,
+                             d->message_neighbours[direction], direction,
+                             receive, receive_bytes, MPI_BYTE,
+                             d->message_neighbours[opposite], direction,
+                             d->comm, MPI_STATUS_IGNORE);
+                if (d->message_neighbours[opposite] != MPI_PROC_NULL)
+                    halo_decode(d, opposite, receive);
+                continue;
+            }
+
+            if (d->message_neighbours[opposite] != MPI_PROC_NULL)
+                MPI_Irecv(receive, receive_bytes, MPI_BYTE,
+                          d->message_neighbours[opposite], direction, d->comm,
+                          &d->requests[d->num_requests++]);
+            if (d->message_neighbours[direction] != MPI_PROC_NULL)
+                MPI_Isend(send, send_bytes, MPI_BYTE,
+                          d->message_neighbours[direction], direction,
+                          d->comm, &d->requests[d->num_requests++]);
+            continue;
+        }
+
+        if (d->active_set)
+        {
+            // An edge unchanged since it was last sent goes as an empty message
+            MPI_Status status;
+            MPI_Sendrecv(edge, d->edges_sent ? 0 : 1,
+                         d->halo_types[direction],
+                         d->message_neighbours[direction], direction, ghost,
+                         1, d->halo_types[opposite],
+                         d->message_neighbours[opposite], direction, d->comm,
+                         &status);
+
+            // Keep the new ghost cells whichever cell array is swept next
+            int received;
+            MPI_Get_count(&status, d->halo_types[opposite], &received);
+            if (d->message_neighbours[opposite] != MPI_PROC_NULL &&
+                received > 0)
+            {
+                size_t offset = d->ghost_offsets[opposite];
+                for (size_t i = 0; i < d->halo_rows[opposite]; i++)
+                    memcpy(d->next + offset + i * d->stride,
+                           d->cells + offset + i * d->stride,
+                           d->halo_columns[opposite] * sizeof(double));
+            }
+            continue;
+        }
+
+        if (!d->nonblocking)
+        {
+            MPI_Sendrecv(edge, 1, d->halo_types[direction],
+                         d->message_neighbours[direction], direction,
+                         ghost, 1, d->halo_types[opposite],
+                         d->message_neighbours[opposite], direction, d->comm,
+                         MPI_STATUS_IGNORE);
+            continue;
+        }
+
+        // Boundary sides have nothing to exchange
+        if (d->message_neighbours[opposite] != MPI_PROC_NULL)
+            MPI_Irecv(ghost, 1, d->halo_types[opposite],
+                      d->message_neighbours[opposite], direction, d->comm,
+                      &d->requests[d->num_requests++]);
+        if (d->message_neighbours[direction] != MPI_PROC_NULL)
+            MPI_Isend(edge, 1, d->halo_types[direction],
+                      d->message_neighbours[direction], direction, d->comm,
+                      &d->requests[d->num_requests++]);
+    }
+    if (d->active_set)
+        d->edges_sent = true;
+}
+
+void halo_end(domain *d)
+{
+    if (d->rma_windows[0] != MPI_WIN_NULL)
+    {
+        MPI_Win window = d->rma_windows[d->rma_set];
+        if (d->rma_fence)
+            MPI_Win_fence(MPI_MODE_NOSUCCEED, window);
+        else
+        {
+            MPI_Win_complete(window);
+            MPI_Win_wait(window);
+        }
+        return;
+    }
+
+    if (d->persistent)
+    {
+        MPI_Waitall(d->num_persistent_requests,
+                    d->persistent_requests[d->persistent_set],
+                    MPI_STATUSES_IGNORE);
+        return;
+    }
+
+    MPI_Waitall(d->num_requests, d->requests, MPI_STATUSES_IGNORE);
+    d->num_requests = 0;
+
+    // Blocking exchanges decode each side as soon as it arrives
+    if (d->codec != HALO_CODEC_NONE && d->nonblocking)
+        for (int direction = 0; direction < NUM_DIRECTIONS; direction++)
+            if (d->message_neighbours[direction] != MPI_PROC_NULL)
+                halo_decode(d, direction, d->codec_receives[direction]);
+}
+
+void halo_persistent_init(domain *d)
+{
+    for (int set = 0; set < 2; set++)
+    {
+        double *cells = d->cell_arrays[set];
+        int count = 0;
+        for (int direction = 0; direction < NUM_DIRECTIONS; direction++)
+        {
+            // Boundary sides have nothing to exchange
+            int opposite = direction ^ 1;
+            if (d->message_neighbours[opposite] != MPI_PROC_NULL)
+                MPI_Recv_init(cells + d->ghost_offsets[opposite], 1,
+                              d->halo_types[opposite],
+                              d->message_neighbours[opposite], direction, d->comm,
+                              &d->persistent_requests[set][count++]);
+            if (d->message_neighbours[direction] != MPI_PROC_NULL)
+                MPI_Send_init(cells + d->edge_offsets[direction], 1,
+                              d->halo_types[direction],
+                              d->message_neighbours[direction], direction, d->comm,
+                              &d->persistent_requests[set][count++]);
+        }
+        d->num_persistent_requests = count;
+    }
+    d->persistent = true;
+}
+
+void halo_shared_init(domain *d)
+{
+    MPI_Comm_split_type(d->comm, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL,
+                        &d->node_comm);
+
+    // Each process keeps its two cell arrays one after the other
+    size_t cells = d->length;
+    double *base;
+    MPI_Win_allocate_shared(2 * cells * sizeof(double), sizeof(double),
+                            MPI_INFO_NULL, d->node_comm, &base,
+                            &d->shared_window);
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, d->shared_window);
+    memcpy(base, d->cells, cells * sizeof(double));
+    memcpy(base + cells, d->next, cells * sizeof(double));
+    free(d->cells);
+    free(d->next);
+    d->cells = base;
+    d->next = base + cells;
+    d->cell_arrays[0] = d->cells;
+    d->cell_arrays[1] = d->next;
+
+    MPI_Group group, node_group;
+    MPI_Comm_group(d->comm, &group);
+    MPI_Comm_group(d->node_comm, &node_group);
+    for (int direction = 0; direction < NUM_DIRECTIONS; direction++)
+    {
+        d->shared_edges[0][direction] = NULL;
+        d->shared_edges[1][direction] = NULL;
+        int neighbour = d->neighbours[direction];
+        if (neighbour == MPI_PROC_NULL)
+            continue;
+
+        int node_rank;
+        MPI_Group_translate_ranks(group, 1, &neighbour, node_group,
+                                  &node_rank);
+        if (node_rank == MPI_UNDEFINED)
+            continue;
+
+        // Find the edge of the neighbour facing this block
+        size_t starts[2], counts[2];
+        domain_block(d, neighbour, starts, counts);
+        size_t stride = counts[1] + 2;
+        size_t offset = stride + 1;
+        if (direction == DIRECTION_UP)
+            offset = counts[0] * stride + 1;
+        else if (direction == DIRECTION_LEFT)
+            offset = stride + counts[1];
+
+        MPI_Aint segment_size;
+        int disp_unit;
+        double *segment;
+        MPI_Win_shared_query(d->shared_window, node_rank, &segment_size,
+                             &disp_unit, &segment);
+        d->shared_edges[0][direction] = segment + offset;
+        d->shared_edges[1][direction] =
+            segment + (counts[0] + 2) * stride + offset;
+        d->shared_steps[direction] =
+            direction == DIRECTION_UP || direction == DIRECTION_DOWN ? 1
+                                                                     : stride;
+        d->message_neighbours[direction] = MPI_PROC_NULL;
+    }
+    MPI_Group_free(&group);
+    MPI_Group_free(&node_group);
+}
+
+void halo_rma_init(domain *d, bool fence)
+{
+    // A single block has nothing to exchange
+    int num_processes;
+    MPI_Comm_size(d->comm, &num_processes);
+    if (num_processes == 1)
+        return;
+
+    size_t cells = d->length;
+    for (int set = 0; set < 2; set++)
+        MPI_Win_create(d->cell_arrays[set], cells * sizeof(double),
+                       sizeof(double), MPI_INFO_NULL, d->comm,
+                       &d->rma_windows[set]);
+    d->rma_fence = fence;
+
+    // Only the neighbours access each window between fences or epochs
+    int ranks[NUM_DIRECTIONS];
+    int num_ranks = 0;
+    for (int direction = 0; direction < NUM_DIRECTIONS; direction++)
+    {
+        int neighbour = d->neighbours[direction];
+        d->rma_types[direction] = MPI_DATATYPE_NULL;
+        if (neighbour == MPI_PROC_NULL)
+            continue;
+        ranks[num_ranks++] = neighbour;
+
+        // Find the ghost cells of the neighbour facing this block
+        size_t starts[2], counts[2];
+        domain_block(d, neighbour, starts, counts);
+        MPI_Aint stride = counts[1] + 2;
+        if (direction == DIRECTION_UP)
+            d->rma_displacements[direction] = (counts[0] + 1) * stride + 1;
+        else if (direction == DIRECTION_DOWN)
+            d->rma_displacements[direction] = 1;
+        else if (direction == DIRECTION_LEFT)
+            d->rma_displacements[direction] = stride + counts[1] + 1;
+        else
+            d->rma_displacements[direction] = stride;
+
+        if (direction == DIRECTION_UP || direction == DIRECTION_DOWN)
+            type_rows(1, d->columns, d->stride, &d->rma_types[direction]);
+        else
+            type_rows(d->rows, 1, stride, &d->rma_types[direction]);
+    }
+
+    MPI_Group group;
+    MPI_Comm_group(d->comm, &group);
+    MPI_Group_incl(group, num_ranks, ranks, &d->rma_group);
+    MPI_Group_free(&group);
+}
+
+void halo_rma_free(domain *d)
+{
+    for (int set = 0; set < 2; set++)
+        MPI_Win_free(&d->rma_windows[set]);
+    for (int direction = 0; direction < NUM_DIRECTIONS; direction++)
+        if (d->rma_types[direction] != MPI_DATATYPE_NULL)
+            MPI_Type_free(&d->rma_types[direction]);
+    MPI_Group_free(&d->rma_group);
+}
+
+void halo_neighbour_init(domain *d)
+{
+    /* The edge facing each neighbour is also the side its ghost cells fill,
+    and the library is told how many cells go each way */
+    int ranks[NUM_DIRECTIONS], weights[NUM_DIRECTIONS];
+    int count = 0;
+    for (int direction = 0; direction < NUM_DIRECTIONS; direction++)
+    {
+        if (d->neighbours[direction] == MPI_PROC_NULL)
+            continue;
+        ranks[count] = d->neighbours[direction];
+        weights[count] = d->halo_rows[direction] * d->halo_columns[direction];
+        d->neighbour_counts[count] = 1;
+        d->neighbour_types[count] = d->halo_types[direction];
+        d->neighbour_sends[count] =
+            (d->edge_offsets[direction] - d->first_cell) * sizeof(double);
+        d->neighbour_receives[count] =
+            d->ghost_offsets[direction] * sizeof(double);
+        count++;
+    }
+
+    MPI_Dist_graph_create_adjacent(d->comm, count, ranks, weights, count,
+                                   ranks, weights, MPI_INFO_NULL, 0,
+                                   &d->neighbour_comm);
+}
+
+void halo_neighbour_free(domain *d)
+{
+    MPI_Comm_free(&d->neighbour_comm);
+}
+
+void halo_persistent_free(domain *d)
+{
+    for (int set = 0; set < 2; set++)
+        for (int k = 0; k < d->num_persistent_requests; k++)
+            MPI_Request_free(&d->persistent_requests[set][k]);
+    d->persistent = false;
+}
+
+void halo_codec_init(domain *d, enum halo_codec codec)
+{
+    d->codec = codec;
+    for (int direction = 0; direction < NUM_DIRECTIONS; direction++)
+    {
+        d->codec_sends[direction] = malloc(halo_codec_bytes(d, direction));
+        d->codec_receives[direction] = malloc(halo_codec_bytes(d, direction));
+    }
+}
+
+void halo_codec_free(domain *d)
+{
+    d->codec = HALO_CODEC_NONE;
+    for (int direction = 0; direction < NUM_DIRECTIONS; direction++)
+    {
+        free(d->codec_sends[direction]);
+        free(d->codec_receives[direction]);
+        d->codec_sends[direction] = NULL;
+        d->codec_receives[direction] = NULL;
+    }
+}
+
+size_t halo_codec_bytes(const domain *d, int direction)
+{
+    size_t cells = d->halo_rows[direction] * d->halo_columns[direction];
+    if (d->codec == HALO_CODEC_FLOAT)
+        return cells * sizeof(float);
+    // The quantized levels follow the offset and step between them
+    return 2 * sizeof(double) + cells * sizeof(uint16_t);
+}
+
+void halo_encode(const domain *d, int direction, unsigned char *buffer)
+{
+    const double *edge = d->cells + d->edge_offsets[direction];
+    size_t rows = d->halo_rows[direction];
+    size_t columns = d->halo_columns[direction];
+
+    if (d->codec == HALO_CODEC_FLOAT)
+    {
+        float *values = (float *)buffer;
+        for (size_t i = 0; i < rows; i++)
+            for (size_t j = 0; j < columns; j++)
+                *values++ = (float)edge[i * d->stride + j];
+        return;
+    }
+
+    double lowest = edge[0];
+    double highest = edge[0];
+    for (size_t i = 0; i < rows; i++)
+        for (size_t j = 0; j < columns; j++)
+        {
+            lowest = fmin(lowest, edge[i * d->stride + j]);
+            highest = fmax(highest, edge[i * d->stride + j]);
+        }
+    double step = (highest - lowest) / UINT16_MAX;
+
+    double header[2] = {lowest, step};
+    memcpy(buffer, header, sizeof(header));
+    uint16_t *levels = (uint16_t *)(buffer + sizeof(header));
+    for (size_t i = 0; i < rows; i++)
+        for (size_t j = 0; j < columns; j++)
+            *levels++ = step > 0
+                            ? (uint16_t)lround((edge[i * d->stride + j] -
+                                                lowest) /
+                                               step)
+                            : 0;
+}
+
+void halo_decode(domain *d, int direction, const unsigned char *buffer)
+{
+    double *ghost = d->cells + d->ghost_offsets[direction];
+    size_t rows = d->halo_rows[direction];
+    size_t columns = d->halo_columns[direction];
+
+    if (d->codec == HALO_CODEC_FLOAT)
+    {
+        const float *values = (const float *)buffer;
+        for (size_t i = 0; i < rows; i++)
+            for (size_t j = 0; j < columns; j++)
+                ghost[i * d->stride + j] = *values++;
+        return;
+    }
+
+    double header[2];
+    memcpy(header, buffer, sizeof(header));
+    const uint16_t *levels = (const uint16_t *)(buffer + sizeof(header));
+    for (size_t i = 0; i < rows; i++)
+        for (size_t j = 0; j < columns; j++)
+            ghost[i * d->stride + j] = header[0] + *levels++ * header[1];
+}
+
+bool halo_codec_update(domain *d, double change, double precision)
+{
+    if (d->codec == HALO_CODEC_NONE)
+        return false;
+
+    // The error of either codec is relative to cells of order one here
+    double resolution = d->codec == HALO_CODEC_FLOAT ? FLT_EPSILON
+                                                     : 1.0 / UINT16_MAX;
+    if (change > fmax(HALO_CODEC_MARGIN * precision,
+                      HALO_CODEC_NOISE * resolution))
+        return false;
+
+    d->codec = HALO_CODEC_NONE;
+    return true;
+}
+
+void active_set_init(domain *d)
+{
+    d->active_set = true;
+    d->edges_sent = false;
+    for (int direction = 0; direction < NUM_DIRECTIONS; direction++)
+        d->active_ghosts[direction] =
+            malloc(d->halo_rows[direction] * d->halo_columns[direction] *
+                   sizeof(double));
+
+    // Both cell arrays start with the same ghost cells
+    memcpy(d->next, d->cells, d->length * sizeof(double));
+    active_set_save(d);
+}
+
+void active_set_free(domain *d)
+{
+    d->active_set = false;
+    for (int direction = 0; direction < NUM_DIRECTIONS; direction++)
+    {
+        free(d->active_ghosts[direction]);
+        d->active_ghosts[direction] = NULL;
+    }
+}
+
+void active_set_save(domain *d)
+{
+    for (int direction = 0; direction < NUM_DIRECTIONS; direction++)
+    {
+        const double *ghost = d->cells + d->ghost_offsets[direction];
+        double *saved = d->active_ghosts[direction];
+        for (size_t i = 0; i < d->halo_rows[direction]; i++)
+            for (size_t j = 0; j < d->halo_columns[direction]; j++)
+                *saved++ = ghost[i * d->stride + j];
+    }
+}
+
+double active_set_drift(const domain *d)
+{
+    // The fixed boundary never moves
+    double drift = 0;
+    for (int direction = 0; direction < NUM_DIRECTIONS; direction++)
+    {
+        if (d->message_neighbours[direction] == MPI_PROC_NULL)
+            continue;
+
+        const double *ghost = d->cells + d->ghost_offsets[direction];
+        const double *saved = d->active_ghosts[direction];
+        for (size_t i = 0; i < d->halo_rows[direction]; i++)
+            for (size_t j = 0; j < d->halo_columns[direction]; j++)
+                drift = fmax(drift, fabs(ghost[i * d->stride + j] - *saved++));
+    }
+    return drift;
+}
+
+void halo_corners(domain *d)
+{
+    for (int corner = 0; corner < 4; corner++)
+    {
+        // Send towards the diagonal neighbour, receive from the opposite one
+        int step[2] = {corner & 1 ? 1 : -1, corner & 2 ? 1 : -1};
+        int ranks[2];
+        for (int side = 0; side < 2; side++)
+        {
+            int sign = side == 0 ? 1 : -1;
+            int coords[2] = {d->coords[0] + sign * step[0],
+                             d->coords[1] + sign * step[1]};
+            ranks[side] = MPI_PROC_NULL;
+            if (coords[0] >= 0 && coords[0] < d->dims[0] && coords[1] >= 0 &&
+                coords[1] < d->dims[1])
+                MPI_Cart_rank(d->comm, coords, &ranks[side]);
+        }
+
+        // Count from the corner of the innermost ghost ring
+        double *ring = d->cells + d->first_cell - d->stride - 1;
+        size_t edge_row = step[0] < 0 ? 1 : d->rows;
+        size_t edge_column = step[1] < 0 ? 1 : d->columns;
+        size_t ghost_row = step[0] < 0 ? d->rows + 1 : 0;
+        size_t ghost_column = step[1] < 0 ? d->columns + 1 : 0;
+        MPI_Sendrecv(ring + edge_row * d->stride + edge_column, 1,
+                     MPI_DOUBLE, ranks[0], corner,
+                     ring + ghost_row * d->stride + ghost_column, 1,
+                     MPI_DOUBLE, ranks[1], corner, d->comm,
+                     MPI_STATUS_IGNORE);
+    }
+}
+
+void pool_start(thread_pool *pool, int num_threads)
+{
+    pool->num_threads = num_threads;
+    pool->threads = malloc(num_threads * sizeof(pthread_t));
+    pool->members = malloc(num_threads * sizeof(pool_member));
+    pool->changes = calloc(num_threads, sizeof(double));
+    pool->stop = false;
+    pthread_barrier_init(&pool->start, NULL, num_threads);
+    pthread_barrier_init(&pool->finish, NULL, num_threads);
+
+    // The main thread is the first member of the pool
+    for (int id = 1; id < num_threads; id++)
+    {
+        pool->members[id].pool = pool;
+        pool->members[id].id = id;
+        pthread_create(&pool->threads[id], NULL, pool_worker,
+                       &pool->members[id]);
+    }
+}
+
+void pool_stop(thread_pool *pool)
+{
+    pool->stop = true;
+    pthread_barrier_wait(&pool->start);
+    for (int id = 1; id < pool->num_threads; id++)
+        pthread_join(pool->threads[id], NULL);
+
+    pthread_barrier_destroy(&pool->start);
+    pthread_barrier_destroy(&pool->finish);
+    free(pool->threads);
+    free(pool->members);
+    free(pool->changes);
+}
+
+void pool_relax_strip(thread_pool *pool, int id)
+{
+    // Spread the rows as evenly as possible over the threads
+    size_t first = pool->rows * id / pool->num_threads;
+    size_t last = pool->rows * (id + 1) / pool->num_threads;
+    domain *d = pool->d;
+    size_t offset = pool->offset + first * d->stride;
+    pool->changes[id] = relax_cells(d->cells + offset, d->next + offset,
+                                    last - first, pool->columns, d->stride);
+}
+
+void *pool_worker(void *args)
+{
+    pool_member *member = (pool_member *)args;
+    thread_pool *pool = member->pool;
+    while (true)
+    {
+        // Wait for the main thread to set the next rectangle
+        pthread_barrier_wait(&pool->start);
+        if (pool->stop)
+            break;
+
+        pool_relax_strip(pool, member->id);
+        pthread_barrier_wait(&pool->finish);
+    }
+    return NULL;
+}
+
+void progress_start(progress_thread *p, MPI_Comm comm)
+{
+    MPI_Comm_dup(comm, &p->comm);
+    atomic_store(&p->running, true);
+    pthread_create(&p->thread, NULL, progress_loop, p);
+}
+
+void progress_stop(progress_thread *p)
+{
+    atomic_store(&p->running, false);
+    pthread_join(p->thread, NULL);
+    MPI_Comm_free(&p->comm);
+}
+
+void *progress_loop(void *args)
+{
+    progress_thread *p = (progress_thread *)args;
+    struct timespec interval = {0, PROGRESS_INTERVAL};
+    while (atomic_load(&p->running))
+    {
+        // Any call into the library advances the requests in flight
+        int flag;
+        MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, p->comm, &flag,
+                   MPI_STATUS_IGNORE);
+        nanosleep(&interval, NULL);
     }
+    return NULL;
 }
\ No newline at end of file
@@ -3,9 +3,13 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <math.h>
+#include <complex.h>
 #include <pthread.h>
 #include <unistd.h>
 #include <string.h>
+#include <getopt.h>
+#include <sched.h>
+#include <stdatomic.h>
 
 enum log_level
 {
@@ -17,6 +21,51 @@ enum log_level
   LOG_NONE = 5
 };
 
+enum method
+{
+  // Jacobi sweeps over the whole matrix, one synchronisation per sweep.
+  METHOD_JACOBI = 0,
+  /* Each thread runs Gauss-Seidel sweeps over its own row strip and only
+  exchanges the rows bordering the strip between global steps. */
+  METHOD_BLOCK_GS = 1,
+  /* Lexicographic Gauss-Seidel pipelined over row strips, with several sweeps
+  in flight at once. */
+  METHOD_WAVEFRONT = 2,
+  /* Solve the discrete Laplace problem exactly with a two dimensional discrete
+  sine transform. */
+  METHOD_DIRECT = 3,
+  /* Iterative refinement: Jacobi sweeps run on a float correction grid,
+  periodically corrected by the true residual of the double matrix. */
+  METHOD_MIXED = 4
+};
+
+// Number of columns relaxed by a strip before it publishes its progress.
+#define WAVEFRONT_BLOCK_COLUMNS 64
+/* Largest prime factor handled by the mixed radix FFT. Lengths with a larger
+prime factor use Bluestein's algorithm over a power of two instead. */
+#define FFT_MAX_RADIX 13
+// Enough radices for any length that fits in a size_t.
+#define FFT_MAX_FACTORS 64
+
+// A precomputed complex FFT of a fixed length.
+typedef struct fft_plan
+{
+  size_t length;
+  // Radices applied by the recursion, outermost first.
+  size_t factors[FFT_MAX_FACTORS];
+  size_t num_factors;
+  // exp(-2 pi i k / length) for k < length.
+  double complex *twiddles;
+  /* Bluestein's algorithm, used when the length has a prime factor larger
+  than FFT_MAX_RADIX. The chirp holds exp(-pi i k^2 / length), the filter is
+  the transformed conjugate chirp and convolution is a power of two plan. */
+  double complex *chirp;
+  double complex *filter;
+  struct fft_plan *convolution;
+  // Number of complex values fft_execute needs as workspace.
+  size_t workspace_length;
+} fft_plan;
+
 // Global variables
 struct
 {
@@ -24,15 +73,30 @@ struct
   double precision;
   int num_threads;
   enum log_level log_level;
+  enum method method;
+  /* Number of local sweeps per global step. Gauss-Seidel sweeps over each
+  strip for the block Gauss-Seidel method, float sweeps per refinement for the
+  mixed precision method. */
+  int local_sweeps;
+  // Number of grids used by nested iteration, including the finest one.
+  int levels;
+  // Number of sweeps taken by the last solve.
+  int iterations;
   double **matrix;
 } shared_args;
 
 typedef struct
 {
   int id;
-  int start_i;
-  int start_j;
-  int cells;
+  size_t start_i;
+  size_t start_j;
+  size_t cells;
+  // Number of rows in the strip owned by the thread (block Gauss-Seidel).
+  size_t rows;
+  /* Copies of the rows bordering the strip, refreshed between global steps
+  (block Gauss-Seidel). */
+  double *ghost_above;
+  double *ghost_below;
   double **original_matrix;
   double **new_matrix;
 } thread_args;
@@ -45,6 +109,27 @@ been reached on the thread, false otherwise. */
 bool *THREAD_PRECISION_REACHED;
 // Barrier for all threads.
 pthread_barrier_t barrier;
+/* Wavefront progress, one counter per strip. Counts the column blocks the
+strip has relaxed, across all sweeps. */
+atomic_long *STRIP_PROGRESS;
+/* The latest wavefront sweep in which a cell changed by more than the
+precision. A strip only starts a sweep once the previous one is known not to
+have converged, so every sweep up to this one is unconverged too. */
+atomic_long LAST_UNCONVERGED_SWEEP;
+/* Plan for the complex FFT behind the sine transform of the direct method,
+shared read only by all threads. */
+fft_plan *DST_PLAN;
+/* Eigenvalues of the one dimensional discrete Laplacian, indexed by sine
+transform frequency. */
+double *DST_EIGENVALUES;
+/* Mixed precision grids. The residual holds the change a Jacobi sweep would
+make to each cell of the double matrix, and the correction is solved for in
+float from it, double buffered. Their boundaries stay zero. */
+float **RESIDUAL;
+float **CORRECTION;
+float **NEXT_CORRECTION;
+// Barrier for the worker threads only, excluding the main thread.
+pthread_barrier_t worker_barrier;
 
 // --- Begin function prototypes ---
 
@@ -55,34 +140,165 @@ void print_matrix(double **matrix);
 else. */
 double **matrix_init();
 
+// Allocate an n x n matrix holding a copy of another one.
+double **matrix_copy(double **matrix);
+
+// Free an n x n matrix.
+void matrix_free(double **matrix);
+
+/* Bilinearly interpolate one square matrix onto another of a different size,
+both covering the same unit square. Only the inner cells of the target are
+written when inner_only is set, leaving its boundary untouched. */
+void matrix_resample(double **source, size_t source_size,
+                     double **target, size_t target_size, bool inner_only);
+
 // Apply the relaxation technique to a matrix in parallel.
 double **relax_matrix_parallel(double **matrix);
 
+/* Apply the relaxation technique on a hierarchy of grids, halving the size at
+each level, with each coarse solution as the starting point of the next finer
+level. */
+double **relax_matrix_nested(double **matrix);
+
 /* Use the relaxation technique to compute the average of a group of cells in
 a matrix. */
 void *relax_cells(void *args);
 
+/* Run Gauss-Seidel sweeps in place over the row strip owned by a thread, using
+the ghost rows captured at the start of the global step. */
+void *relax_strip(void *args);
+
+/* Run pipelined lexicographic Gauss-Seidel sweeps over the row strip owned by
+a thread, waiting on the neighbouring strips' progress counters. */
+void *relax_wavefront(void *args);
+
 // Determine the arguments for all child threads.
 void determine_thread_data(
     double **original_matrix,
     double **new_matrix,
     thread_args *thread_data);
 
+/* Refine the strip of the double matrix owned by a thread, with float Jacobi
+sweeps solving for each correction. */
+void *relax_mixed(void *args);
+
+/* Solve for the inner cells directly. Each thread transforms its strip of rows
+and the same range of columns. */
+void *solve_direct(void *args);
+
+// Plan a complex FFT of the given length.
+fft_plan *fft_plan_create(size_t length);
+
+// Free an FFT plan.
+void fft_plan_destroy(fft_plan *plan);
+
+/* Compute the forward FFT of in into out, both of plan->length values, using
+plan->workspace_length values of workspace. */
+void fft_execute(const fft_plan *plan, const double complex *in,
+                 double complex *out, double complex *workspace);
+
+/* Compute the type I discrete sine transforms of two sequences of n values in
+place, where the plan has length 2 * (n + 1). The second sequence may be NULL.
+The workspace must hold 2 * plan->length + plan->workspace_length values. */
+void dst_execute(const fft_plan *plan, double *first, double *second,
+                 double complex *workspace);
+
+// Split the inner rows of the matrix into one strip per thread.
+void determine_strip_data(double **matrix, thread_args *thread_data);
+
+// Copy the rows bordering each thread's strip into its ghost rows.
+void exchange_ghost_rows(double **matrix, thread_args *thread_data);
+
 // --- End function prototypes ---
 
 // Program Entry
 int main(int argc, char *argv[])
 {
+  const char *usage =
+      "Usage: %s [--method jacobi|block-gs|wavefront|direct|mixed] "
+      "[--local-sweeps k] [--levels n] "
+      "<matrix size> <precision> <num threads> [log level]";
+  static struct option long_options[] = {
+      {"method", required_argument, NULL, 'm'},
+      {"local-sweeps", required_argument, NULL, 'k'},
+      {"levels", required_argument, NULL, 'l'},
+      {NULL, 0, NULL, 0}};
+
+  shared_args.method = METHOD_JACOBI;
+  // Zero picks the default of the method
+  shared_args.local_sweeps = 0;
+  shared_args.levels = 1;
+
+  // Parse options
+  int option;
+  while ((option = getopt_long(argc, argv, "", long_options, NULL)) != -1)
+  {
+    switch (option)
+    {
+    case 'm':
+      if (strcmp(optarg, "jacobi") == 0)
+        shared_args.method = METHOD_JACOBI;
+      else if (strcmp(optarg, "block-gs") == 0)
+        shared_args.method = METHOD_BLOCK_GS;
+      else if (strcmp(optarg, "wavefront") == 0)
+        shared_args.method = METHOD_WAVEFRONT;
+      else if (strcmp(optarg, "direct") == 0)
+        shared_args.method = METHOD_DIRECT;
+      else if (strcmp(optarg, "mixed") == 0)
+        shared_args.method = METHOD_MIXED;
+      else
+      {
+        fprintf(stderr, "Unknown method '%s' \n", optarg);
+        return 1;
+      }
+      break;
+    case 'k':
+      shared_args.local_sweeps = atoi(optarg);
+      if (shared_args.local_sweeps < 1)
+      {
+        fprintf(stderr, "Local sweep count must be greater than 0\n");
+        return 1;
+      }
+      break;
+    case 'l':
+      shared_args.levels = atoi(optarg);
+      if (shared_args.levels < 1)
+      {
+        fprintf(stderr, "Level count must be greater than 0\n");
+        return 1;
+      }
+      break;
+    default:
+      fprintf(stderr, usage, argv[0]);
+      return 1;
+    }
+  }
+
+  /* Refinements are only worth their double precision pass when they are
+  separated by many cheap float sweeps. */
+  if (shared_args.local_sweeps == 0)
+    shared_args.local_sweeps = shared_args.method == METHOD_MIXED ? 32 : 1;
+
+  if (shared_args.method == METHOD_DIRECT && shared_args.levels > 1)
+  {
+    fprintf(stderr, "The direct method does not use a starting guess\n");
+    return 1;
+  }
+
+  // Positional arguments follow the options
+  int num_args = argc - optind;
+  char **args = argv + optind;
+
   // Check for correct number of arguments
-  if (argc < 4 || argc > 5)
+  if (num_args < 3 || num_args > 4)
   {
-    fprintf(stderr, "Usage: %s <matrix size> <precision> <num threads> [log level]", argv[0]);
+    fprintf(stderr, usage, argv[0]);
     return 1;
   }
 
-  if (argc == 5)
+  if (num_args == 4)
   {
-    shared_args.log_level = atoi(argv[4]);
+    shared_args.log_level = atoi(args[3]);
     if (shared_args.log_level < LOG_ALL || shared_args.log_level > LOG_NONE)
     {
       printf("Invalid log level. Must be between %d and %d \n", LOG_ALL, LOG_NONE);
@@ -95,7 +311,7 @@ int main(int argc, char *argv[])
   }
 
   // Parse size
-  shared_args.size = atoi(argv[1]);
+  shared_args.size = atoi(args[0]);
   // Validate size
   if (shared_args.size < 2 || shared_args.size > 10e6)
   {
@@ -104,7 +320,7 @@ int main(int argc, char *argv[])
   }
 
   // Parse precision
-  shared_args.precision = atof(argv[2]);
+  shared_args.precision = atof(args[1]);
   // Validate precision
   if (shared_args.precision <= 0)
   {
@@ -113,13 +329,22 @@ int main(int argc, char *argv[])
   }
 
   // Parse num_threads
-  shared_args.num_threads = atoi(argv[3]);
+  shared_args.num_threads = atoi(args[2]);
   // Validate num_threads
   if (shared_args.num_threads < 1)
   {
     fprintf(stderr, "Thread count must be greater than 0");
     return 1;
   }
+  else if (shared_args.method != METHOD_JACOBI &&
+           shared_args.num_threads > shared_args.size - 2)
+  {
+    printf(
+        "Thread count is greater than the number of rows. "
+        "Using %zu threads.\n",
+        shared_args.size - 2);
+    shared_args.num_threads = shared_args.size - 2;
+  }
   else if (shared_args.num_threads >
            (shared_args.size - 2) * (shared_args.size - 2))
   {
@@ -140,17 +365,19 @@ int main(int argc, char *argv[])
 
   double **a = matrix_init();
 
-  a = relax_matrix_parallel(a);
+  a = relax_matrix_nested(a);
   if (shared_args.log_level <= LOG_INFO)
   {
+    printf("Converged after %d iterations using %d levels \n",
+           shared_args.iterations, shared_args.levels);
     print_matrix(a);
   }
 
-  for (int i = 0; i < shared_args.size; i++)
+  for (size_t i = 0; i < shared_args.size; i++)
   {
     free(a[i]);
     if (shared_args.log_level <= LOG_ALL)
-      printf("Freed row %d at %p \n", i, a[i]);
+      printf("Freed row %zu at %p \n", i, a[i]);
   }
 
   free(a);
@@ -183,11 +410,11 @@ double **matrix_init()
   }
   else
   {
-    for (int i = 0; i < shared_args.size; i++)
+    for (size_t i = 0; i < shared_args.size; i++)
     {
       result[i] = calloc(shared_args.size, sizeof(double));
 
-      for (int j = 0; j < shared_args.size; j++)
+      for (size_t j = 0; j < shared_args.size; j++)
       {
         result[i][j] = shared_args.matrix[i][j];
       }
@@ -233,9 +460,9 @@ double **matrix_init()
 void print_matrix(double **matrix)
 {
   printf("Display %zu x %zu matrix \n", shared_args.size, shared_args.size);
-  for (int i = 0; i < shared_args.size; i++)
+  for (size_t i = 0; i < shared_args.size; i++)
   {
-    for (int j = 0; j < shared_args.size; j++)
+    for (size_t j = 0; j < shared_args.size; j++)
     {
       printf("%f ", matrix[i][j]);
     }
@@ -247,7 +474,7 @@ void print_matrix(double **matrix)
 double **relax_matrix_parallel(double **matrix)
 {
   // Copy the original matrix to a new matrix.
-  double **new_matrix = matrix_init();
+  double **new_matrix = matrix_copy(matrix);
 
   thread_args *thread_data = calloc(
       shared_args.num_threads,
@@ -262,7 +489,55 @@ double **relax_matrix_parallel(double **matrix)
   if (shared_args.log_level <= LOG_DEBUG)
     printf("Allocated memory for new matrix and thread data \n");
 
-  determine_thread_data(matrix, new_matrix, thread_data);
+  void *(*worker)(void *) = relax_cells;
+  if (shared_args.method == METHOD_BLOCK_GS)
+  {
+    // Gauss-Seidel sweeps work in place, so the second matrix is unused.
+    determine_strip_data(matrix, thread_data);
+    exchange_ghost_rows(matrix, thread_data);
+    worker = relax_strip;
+  }
+  else if (shared_args.method == METHOD_WAVEFRONT)
+  {
+    determine_strip_data(matrix, thread_data);
+    STRIP_PROGRESS = calloc(shared_args.num_threads, sizeof(atomic_long));
+    for (int i = 0; i < shared_args.num_threads; i++)
+      atomic_init(&STRIP_PROGRESS[i], 0);
+    atomic_init(&LAST_UNCONVERGED_SWEEP, -1);
+    worker = relax_wavefront;
+  }
+  else if (shared_args.method == METHOD_DIRECT)
+  {
+    determine_strip_data(matrix, thread_data);
+    size_t inner_size = shared_args.size - 2;
+    DST_PLAN = fft_plan_create(2 * (inner_size + 1));
+    DST_EIGENVALUES = malloc((inner_size + 1) * sizeof(double));
+    for (size_t k = 1; k <= inner_size; k++)
+    {
+      double s = sin(M_PI * k / (2.0 * (inner_size + 1)));
+      DST_EIGENVALUES[k] = 4 * s * s;
+    }
+    worker = solve_direct;
+  }
+  else if (shared_args.method == METHOD_MIXED)
+  {
+    determine_strip_data(matrix, thread_data);
+    RESIDUAL = calloc(shared_args.size, sizeof(float *));
+    CORRECTION = calloc(shared_args.size, sizeof(float *));
+    NEXT_CORRECTION = calloc(shared_args.size, sizeof(float *));
+    for (size_t i = 0; i < shared_args.size; i++)
+    {
+      RESIDUAL[i] = calloc(shared_args.size, sizeof(float));
+      CORRECTION[i] = calloc(shared_args.size, sizeof(float));
+      NEXT_CORRECTION[i] = calloc(shared_args.size, sizeof(float));
+    }
+    pthread_barrier_init(&worker_barrier, NULL, shared_args.num_threads);
+    worker = relax_mixed;
+  }
+  else
+  {
+    determine_thread_data(matrix, new_matrix, thread_data);
+  }
   // +1 for controlling the main thread.
   pthread_barrier_init(
       &barrier,
@@ -274,14 +549,25 @@ double **relax_matrix_parallel(double **matrix)
     pthread_create(
         &threads[i],
         NULL,
-        relax_cells,
+        worker,
         &thread_data[i]);
 
   if (shared_args.log_level <= LOG_INFO)
     printf("Threads created \n");
 
   int iterations = 0;
-  while (true)
+  /* Wavefront threads pace each other through their progress counters and
+  stop on their own, so only the iterative methods need the main thread. */
+  bool coordinate = shared_args.method == METHOD_JACOBI ||
+                    shared_args.method == METHOD_BLOCK_GS ||
+                    shared_args.method == METHOD_MIXED;
+  if (shared_args.method == METHOD_DIRECT)
+  {
+    // Wait for the row transforms, then for the column solves.
+    pthread_barrier_wait(&barrier);
+    pthread_barrier_wait(&barrier);
+  }
+  while (coordinate)
   {
     // Wait for all threads to finish.
     pthread_barrier_wait(&barrier);
@@ -310,6 +596,10 @@ double **relax_matrix_parallel(double **matrix)
       {
         THREAD_PRECISION_REACHED[i] = true;
       }
+
+      // Share the new strip edges before the next global step.
+      if (shared_args.method == METHOD_BLOCK_GS)
+        exchange_ghost_rows(matrix, thread_data);
     }
 
     iterations++;
@@ -319,7 +609,16 @@ double **relax_matrix_parallel(double **matrix)
     pthread_barrier_wait(&barrier);
   }
 
-  pthread_barrier_wait(&barrier);
+  if (coordinate)
+  {
+    pthread_barrier_wait(&barrier);
+    // The converged sweep is not counted as an iteration above.
+    shared_args.iterations = iterations + 1;
+  }
+  else if (shared_args.method == METHOD_DIRECT)
+  {
+    shared_args.iterations = 0;
+  }
 
   // Join threads
   for (int i = 0; i < shared_args.num_threads; i++)
@@ -329,12 +628,49 @@ double **relax_matrix_parallel(double **matrix)
     pthread_join(threads[i], NULL);
   }
 
+  if (shared_args.method == METHOD_DIRECT &&
+      shared_args.log_level <= LOG_INFO)
+    printf("Solved directly with a %zu point sine transform \n",
+           shared_args.size - 2);
+
   if (shared_args.log_level <= LOG_DEBUG)
     printf("Threads joined, freeing memory \n");
 
   // Free the memory before exiting the program
   pthread_barrier_destroy(&barrier);
 
+  if (shared_args.method == METHOD_BLOCK_GS)
+  {
+    for (int i = 0; i < shared_args.num_threads; i++)
+    {
+      free(thread_data[i].ghost_above);
+      free(thread_data[i].ghost_below);
+    }
+  }
+
+  if (shared_args.method == METHOD_WAVEFRONT)
+    free(STRIP_PROGRESS);
+
+  if (shared_args.method == METHOD_DIRECT)
+  {
+    fft_plan_destroy(DST_PLAN);
+    free(DST_EIGENVALUES);
+  }
+
+  if (shared_args.method == METHOD_MIXED)
+  {
+    pthread_barrier_destroy(&worker_barrier);
+    for (size_t i = 0; i < shared_args.size; i++)
+    {
+      free(RESIDUAL[i]);
+      free(CORRECTION[i]);
+      free(NEXT_CORRECTION[i]);
+    }
+    free(RESIDUAL);
+    free(CORRECTION);
+    free(NEXT_CORRECTION);
+  }
+
   free(thread_data);
   if (shared_args.log_level <= LOG_ALL)
     printf("Freed thread data at %p \n", thread_data);
@@ -343,11 +679,11 @@ double **relax_matrix_parallel(double **matrix)
   if (shared_args.log_level <= LOG_ALL)
     printf("Freed threads at %p \n", threads);
 
-  for (int i = 0; i < shared_args.size; i++)
+  for (size_t i = 0; i < shared_args.size; i++)
   {
     free(new_matrix[i]);
     if (shared_args.log_level <= LOG_ALL)
-      printf("Freed row %d at %p \n", i, new_matrix[i]);
+      printf("Freed row %zu at %p \n", i, new_matrix[i]);
   }
   free(new_matrix);
   if (shared_args.log_level <= LOG_ALL)
@@ -356,6 +692,101 @@ double **relax_matrix_parallel(double **matrix)
   return matrix;
 }
 
+double **matrix_copy(double **matrix)
+{
+  double **result = malloc(shared_args.size * sizeof(double *));
+  for (size_t i = 0; i < shared_args.size; i++)
+  {
+    result[i] = malloc(shared_args.size * sizeof(double));
+    memcpy(result[i], matrix[i], shared_args.size * sizeof(double));
+  }
+  return result;
+}
+
+void matrix_free(double **matrix)
+{
+  for (size_t i = 0; i < shared_args.size; i++)
+    free(matrix[i]);
+  free(matrix);
+}
+
+void matrix_resample(double **source, size_t source_size,
+                     double **target, size_t target_size, bool inner_only)
+{
+  size_t first = inner_only ? 1 : 0;
+  size_t last = inner_only ? target_size - 2 : target_size - 1;
+  double scale = (double)(source_size - 1) / (target_size - 1);
+  for (size_t i = first; i <= last; i++)
+  {
+    double x = i * scale;
+    size_t i0 = x < source_size - 1 ? (size_t)x : source_size - 2;
+    double di = x - i0;
+    for (size_t j = first; j <= last; j++)
+    {
+      double y = j * scale;
+      size_t j0 = y < source_size - 1 ? (size_t)y : source_size - 2;
+      double dj = y - j0;
+      target[i][j] = (1 - di) * (1 - dj) * source[i0][j0] +
+                     (1 - di) * dj * source[i0][j0 + 1] +
+                     di * (1 - dj) * source[i0 + 1][j0] +
+                     di * dj * source[i0 + 1][j0 + 1];
+    }
+  }
+}
+
+double **relax_matrix_nested(double **matrix)
+{
+  size_t fine_size = shared_args.size;
+  size_t sizes[64] = {fine_size};
+  int levels = 1;
+  // Every level needs at least one inner row per thread.
+  while (levels < shared_args.levels &&
+         (sizes[levels - 1] + 1) / 2 >= shared_args.num_threads + 2)
+  {
+    sizes[levels] = (sizes[levels - 1] + 1) / 2;
+    levels++;
+  }
+  shared_args.levels = levels;
+
+  double **coarse = NULL;
+  size_t coarse_size = 0;
+  for (int level = levels - 1; level > 0; level--)
+  {
+    shared_args.size = sizes[level];
+    if (shared_args.log_level <= LOG_DEBUG)
+      printf("Solving level %d of size %zu x %zu \n", level, sizes[level],
+             sizes[level]);
+
+    // Sample the boundary and starting values of the original problem.
+    double **current = malloc(sizes[level] * sizeof(double *));
+    for (size_t i = 0; i < sizes[level]; i++)
+      current[i] = malloc(sizes[level] * sizeof(double));
+    matrix_resample(matrix, fine_size, current, sizes[level], false);
+
+    // Start from the solution of the coarser level.
+    if (coarse != NULL)
+    {
+      matrix_resample(coarse, coarse_size, current, sizes[level], true);
+      shared_args.size = coarse_size;
+      matrix_free(coarse);
+      shared_args.size = sizes[level];
+    }
+
+    coarse = relax_matrix_parallel(current);
+    coarse_size = sizes[level];
+  }
+
+  if (coarse != NULL)
+  {
+    matrix_resample(coarse, coarse_size, matrix, fine_size, true);
+    shared_args.size = coarse_size;
+    matrix_free(coarse);
+  }
+
+  shared_args.size = fine_size;
+  return relax_matrix_parallel(matrix);
+}
+
 void *relax_cells(void *args)
 {
   thread_args *t_args = (thread_args *)args;
@@ -363,12 +794,12 @@ void *relax_cells(void *args)
   // While the required precision has not been reached
   while (true)
   {
-    int i = t_args->start_i;
-    int j = t_args->start_j;
+    size_t i = t_args->start_i;
+    size_t j = t_args->start_j;
 
     if (shared_args.log_level <= LOG_DEBUG)
-      printf("Thread %d starting at (%d, %d) \n", t_args->id, i, j);
-    for (int c = 0; c < t_args->cells; c++)
+      printf("Thread %d starting at (%zu, %zu) \n", t_args->id, i, j);
+    for (size_t c = 0; c < t_args->cells; c++)
     {
       // Compute the average of the surrounding cells
       double new_value = (t_args->original_matrix[i][j - 1] +
@@ -424,43 +855,616 @@ void determine_thread_data(
     double **new_matrix,
     thread_args *thread_data)
 {
-  // ! An int may be too small
-  uint64_t inner_cells = (shared_args.size - 2) * (shared_args.size - 2);
+  size_t inner_columns = shared_args.size - 2;
+  size_t inner_cells = inner_columns * inner_columns;
   if (shared_args.log_level <= LOG_DEBUG)
     printf("Total inner cells: %zu \n", inner_cells);
-  int cells_per_thread = inner_cells / shared_args.num_threads;
-  int remainder = inner_cells % cells_per_thread;
-  int start_i = 1;
-  int start_j = 1;
+  size_t cells_per_thread = inner_cells / shared_args.num_threads;
+  size_t remainder = inner_cells % shared_args.num_threads;
+  for (int i = 0; i < shared_args.num_threads; i++)
+  {
+    /* The first remainder threads take one extra cell, so the cells before
+    this thread follow directly from its id. */
+    size_t extra = (size_t)i < remainder ? (size_t)i : remainder;
+    size_t first_cell = i * cells_per_thread + extra;
+    thread_data[i].id = i;
+    thread_data[i].start_i = 1 + first_cell / inner_columns;
+    thread_data[i].start_j = 1 + first_cell % inner_columns;
+    thread_data[i].cells = cells_per_thread + ((size_t)i < remainder);
+
+    thread_data[i].original_matrix = original_matrix;
+    thread_data[i].new_matrix = new_matrix;
+
+    if (shared_args.log_level <= LOG_DEBUG)
+      printf("Thread %d will compute %zu cells starting at (%zu, %zu) \n", i,
+             thread_data[i].cells, thread_data[i].start_i,
+             thread_data[i].start_j);
+  }
+}
+
+void *relax_strip(void *args)
+{
+  thread_args *t_args = (thread_args *)args;
+  double **matrix = t_args->original_matrix;
+  size_t first_row = t_args->start_i;
+  size_t last_row = t_args->start_i + t_args->rows - 1;
+
+  // While the required precision has not been reached
+  while (true)
+  {
+    if (shared_args.log_level <= LOG_DEBUG)
+      printf("Thread %d relaxing rows %zu to %zu \n", t_args->id, first_row,
+             last_row);
+
+    for (int sweep = 0; sweep < shared_args.local_sweeps; sweep++)
+    {
+      for (size_t i = first_row; i <= last_row; i++)
+      {
+        /* Rows outside the strip are read from the ghost copies, so that
+        neighbouring threads never see each other's partial updates. */
+        double *above = i == first_row ? t_args->ghost_above : matrix[i - 1];
+        double *below = i == last_row ? t_args->ghost_below : matrix[i + 1];
+        double *row = matrix[i];
+
+        for (size_t j = 1; j < shared_args.size - 1; j++)
+        {
+          // Compute the average of the surrounding cells
+          double new_value = (row[j - 1] + row[j + 1] + above[j] + below[j]) /
+                             4.0;
+
+          // Check if the precision has been reached.
+          if (fabs(new_value - row[j]) > shared_args.precision)
+            THREAD_PRECISION_REACHED[t_args->id] = false;
+
+          // Update in place
+          row[j] = new_value;
+        }
+      }
+    }
+
+    if (shared_args.log_level <= LOG_DEBUG)
+      printf("Thread %d finished iteration \n", t_args->id);
+
+    // Wait for all computation to finish.
+    pthread_barrier_wait(&barrier);
+    // Wait for main thread to check precision and exchange ghost rows.
+    pthread_barrier_wait(&barrier);
+
+    if (PRECISION_REACHED)
+      break;
+  }
+
+  if (shared_args.log_level <= LOG_INFO)
+    printf("Thread %d finished \n", t_args->id);
+  // Terminate self
+  return NULL;
+}
+
+void determine_strip_data(double **matrix, thread_args *thread_data)
+{
+  size_t inner_rows = shared_args.size - 2;
+  size_t rows_per_thread = inner_rows / shared_args.num_threads;
+  size_t remainder = inner_rows % shared_args.num_threads;
+  size_t start_i = 1;
   for (int i = 0; i < shared_args.num_threads; i++)
   {
     thread_data[i].id = i;
     thread_data[i].start_i = start_i;
-    thread_data[i].start_j = start_j;
-    thread_data[i].cells = cells_per_thread;
+    thread_data[i].start_j = 1;
+    thread_data[i].rows = rows_per_thread;
     if (remainder > 0)
     {
-      thread_data[i].cells++;
+      thread_data[i].rows++;
       remainder--;
     }
+    thread_data[i].cells = thread_data[i].rows * (shared_args.size - 2);
 
-    thread_data[i].original_matrix = original_matrix;
-    thread_data[i].new_matrix = new_matrix;
+    // Only block Gauss-Seidel reads the rows bordering each strip from copies
+    thread_data[i].ghost_above = NULL;
+    thread_data[i].ghost_below = NULL;
+    if (shared_args.method == METHOD_BLOCK_GS)
+    {
+      thread_data[i].ghost_above = malloc(shared_args.size * sizeof(double));
+      thread_data[i].ghost_below = malloc(shared_args.size * sizeof(double));
+    }
+    thread_data[i].original_matrix = matrix;
+    thread_data[i].new_matrix = NULL;
 
     if (shared_args.log_level <= LOG_DEBUG)
-      printf("Thread %d will compute %d cells starting at (%d, %d) \n", i,
-             thread_data[i].cells, start_i, start_j);
+      printf("Thread %d will relax %zu rows starting at row %zu \n", i,
+             thread_data[i].rows, start_i);
+
+    start_i += thread_data[i].rows;
+  }
+}
+
+void exchange_ghost_rows(double **matrix, thread_args *thread_data)
+{
+  for (int i = 0; i < shared_args.num_threads; i++)
+  {
+    size_t first_row = thread_data[i].start_i;
+    size_t last_row = first_row + thread_data[i].rows - 1;
+    memcpy(thread_data[i].ghost_above, matrix[first_row - 1],
+           shared_args.size * sizeof(double));
+    memcpy(thread_data[i].ghost_below, matrix[last_row + 1],
+           shared_args.size * sizeof(double));
+  }
+}
+
+void *relax_wavefront(void *args)
+{
+  thread_args *t_args = (thread_args *)args;
+  double **matrix = t_args->original_matrix;
+  int id = t_args->id;
+  size_t first_row = t_args->start_i;
+  size_t last_row = t_args->start_i + t_args->rows - 1;
+  long blocks = (shared_args.size - 2 + WAVEFRONT_BLOCK_COLUMNS - 1) /
+                WAVEFRONT_BLOCK_COLUMNS;
+  atomic_long *last_strip = &STRIP_PROGRESS[shared_args.num_threads - 1];
+
+  for (long sweep = 0;; sweep++)
+  {
+    /* Only start a sweep once the previous one is known not to have
+    converged, so that no cell is relaxed more often than in a serial
+    Gauss-Seidel solve. */
+    if (sweep > 0)
+    {
+      bool converged = false;
+      while (atomic_load(&LAST_UNCONVERGED_SWEEP) < sweep - 1)
+      {
+        // The last strip finishes a sweep after every strip above it.
+        if (atomic_load(last_strip) >= sweep * blocks)
+        {
+          converged = atomic_load(&LAST_UNCONVERGED_SWEEP) < sweep - 1;
+          break;
+        }
+        sched_yield();
+      }
+
+      if (converged)
+      {
+        if (id == shared_args.num_threads - 1)
+          shared_args.iterations = sweep;
+        break;
+      }
+    }
+
+    for (long block = 0; block < blocks; block++)
+    {
+      long unit = sweep * blocks + block;
+
+      // The strip above must have finished this block in this sweep.
+      if (id > 0)
+        while (atomic_load(&STRIP_PROGRESS[id - 1]) < unit + 1)
+          sched_yield();
+      // The strip below must have finished this block in the previous sweep.
+      if (id < shared_args.num_threads - 1)
+        while (atomic_load(&STRIP_PROGRESS[id + 1]) < unit + 1 - blocks)
+          sched_yield();
+
+      size_t first_column = 1 + block * WAVEFRONT_BLOCK_COLUMNS;
+      size_t last_column = first_column + WAVEFRONT_BLOCK_COLUMNS - 1;
+      if (last_column > shared_args.size - 2)
+        last_column = shared_args.size - 2;
+
+      bool precision_reached = true;
+      for (size_t i = first_row; i <= last_row; i++)
+      {
+        for (size_t j = first_column; j <= last_column; j++)
+        {
+          // Compute the average of the surrounding cells
+          double new_value = (matrix[i][j - 1] + matrix[i][j + 1] +
+                              matrix[i - 1][j] + matrix[i + 1][j]) /
+                             4.0;
+
+          // Check if the precision has been reached.
+          if (fabs(new_value - matrix[i][j]) > shared_args.precision)
+            precision_reached = false;
+
+          // Update in place
+          matrix[i][j] = new_value;
+        }
+      }
+
+      // Publish the result of the block before the progress that covers it.
+      if (!precision_reached)
+      {
+        long latest = atomic_load(&LAST_UNCONVERGED_SWEEP);
+        while (latest < sweep &&
+               !atomic_compare_exchange_weak(&LAST_UNCONVERGED_SWEEP,
+                                             &latest, sweep))
+          ;
+      }
+      atomic_store(&STRIP_PROGRESS[id], unit + 1);
+    }
+
+    if (shared_args.log_level <= LOG_INFO &&
+        id == shared_args.num_threads - 1)
+      printf("Finished iteration %ld \n", sweep + 1);
+  }
+
+  if (shared_args.log_level <= LOG_INFO)
+    printf("Thread %d finished \n", t_args->id);
+  // Terminate self
+  return NULL;
+}
+
+void *relax_mixed(void *args)
+{
+  thread_args *t_args = (thread_args *)args;
+  double **matrix = t_args->original_matrix;
+  size_t first_row = t_args->start_i;
+  size_t last_row = t_args->start_i + t_args->rows - 1;
+
+  // While the required precision has not been reached
+  while (true)
+  {
+    /* The true residual, scaled to the change a Jacobi sweep would make, is
+    both the convergence test and the right hand side of the correction. */
+    for (size_t i = first_row; i <= last_row; i++)
+    {
+      for (size_t j = 1; j < shared_args.size - 1; j++)
+      {
+        double change = (matrix[i][j - 1] + matrix[i][j + 1] +
+                         matrix[i - 1][j] + matrix[i + 1][j]) /
+                            4.0 -
+                        matrix[i][j];
+        if (fabs(change) > shared_args.precision)
+          THREAD_PRECISION_REACHED[t_args->id] = false;
+        RESIDUAL[i][j] = (float)change;
+      }
+    }
+
+    // Wait for all computation to finish.
+    pthread_barrier_wait(&barrier);
+    // Wait for main thread to check precision.
+    pthread_barrier_wait(&barrier);
+
+    if (PRECISION_REACHED)
+      break;
+
+    /* Jacobi sweeps on the correction, starting from zero, so the first sweep
+    is the residual itself. */
+    float **correction = CORRECTION;
+    float **next_correction = NEXT_CORRECTION;
+    for (size_t i = first_row; i <= last_row; i++)
+      memcpy(&correction[i][1], &RESIDUAL[i][1],
+             (shared_args.size - 2) * sizeof(float));
 
-    int cells_remaining = thread_data[i].cells;
-    while (cells_remaining > 0)
+    for (int sweep = 1; sweep < shared_args.local_sweeps; sweep++)
     {
-      start_j++;
-      cells_remaining--;
-      if (start_j == shared_args.size - 1)
+      // Wait for the neighbouring strips of the previous sweep.
+      pthread_barrier_wait(&worker_barrier);
+      for (size_t i = first_row; i <= last_row; i++)
       {
-        start_j = 1;
-        start_i++;
+        for (size_t j = 1; j < shared_args.size - 1; j++)
+        {
+          next_correction[i][j] =
+              (correction[i][j - 1] + correction[i][j + 1] +
+               correction[i - 1][j] + correction[i + 1][j]) *
+                  0.25f +
+              RESIDUAL[i][j];
+        }
       }
+
+      // Swap the correction grids, in step with the other threads.
+      float **temp = correction;
+      correction = next_correction;
+      next_correction = temp;
     }
+
+    // Apply the correction to the double matrix.
+    for (size_t i = first_row; i <= last_row; i++)
+      for (size_t j = 1; j < shared_args.size - 1; j++)
+        matrix[i][j] += correction[i][j];
+
+    // The next residual reads the neighbouring strips' corrected rows.
+    pthread_barrier_wait(&worker_barrier);
+  }
+
+  if (shared_args.log_level <= LOG_INFO)
+    printf("Thread %d finished \n", t_args->id);
+  // Terminate self
+  return NULL;
+}
+
+void *solve_direct(void *args)
+{
+  thread_args *t_args = (thread_args *)args;
+  double **matrix = t_args->original_matrix;
+  size_t n = shared_args.size - 2;
+  size_t first = t_args->start_i;
+  size_t last = t_args->start_i + t_args->rows - 1;
+
+  double complex *workspace = malloc(
+      (2 * DST_PLAN->length + DST_PLAN->workspace_length) *
+      sizeof(double complex));
+  double *columns = malloc(2 * n * sizeof(double));
+
+  /* The fixed boundary cells neighbouring an inner cell form the right hand
+  side of the discrete Laplace equation. They are only read, so each strip can
+  overwrite its inner cells with the right hand side. */
+  for (size_t i = first; i <= last; i++)
+  {
+    for (size_t j = 1; j <= n; j++)
+    {
+      double rhs = 0;
+      if (i == 1)
+        rhs += matrix[0][j];
+      if (i == n)
+        rhs += matrix[n + 1][j];
+      if (j == 1)
+        rhs += matrix[i][0];
+      if (j == n)
+        rhs += matrix[i][n + 1];
+      matrix[i][j] = rhs;
+    }
+  }
+
+  // Rows are transformed in pairs.
+  for (size_t i = first; i <= last; i += 2)
+    dst_execute(DST_PLAN, &matrix[i][1], i < last ? &matrix[i + 1][1] : NULL,
+                workspace);
+
+  if (shared_args.log_level <= LOG_DEBUG)
+    printf("Thread %d transformed rows %zu to %zu \n", t_args->id, first,
+           last);
+
+  // Wait for all rows to be transformed.
+  pthread_barrier_wait(&barrier);
+
+  /* The sine transform diagonalises the Laplacian, so after transforming a
+  column each coefficient is divided by its eigenvalue and transformed back. */
+  for (size_t j = first; j <= last; j += 2)
+  {
+    // Columns are transformed in pairs too, the second may be missing.
+    size_t pair = j < last ? 2 : 1;
+    double *second = pair == 2 ? columns + n : NULL;
+    for (size_t i = 1; i <= n; i++)
+      for (size_t c = 0; c < pair; c++)
+        columns[c * n + i - 1] = matrix[i][j + c];
+
+    dst_execute(DST_PLAN, columns, second, workspace);
+    for (size_t i = 1; i <= n; i++)
+      for (size_t c = 0; c < pair; c++)
+        columns[c * n + i - 1] /= DST_EIGENVALUES[i] + DST_EIGENVALUES[j + c];
+    dst_execute(DST_PLAN, columns, second, workspace);
+
+    for (size_t i = 1; i <= n; i++)
+      for (size_t c = 0; c < pair; c++)
+        matrix[i][j + c] = columns[c * n + i - 1];
+  }
+
+  // Wait for all columns to be solved.
+  pthread_barrier_wait(&barrier);
+
+  // The sine transform is its own inverse up to a factor of 2 / (n + 1).
+  double scale = 2.0 / (n + 1);
+  for (size_t i = first; i <= last; i += 2)
+    dst_execute(DST_PLAN, &matrix[i][1], i < last ? &matrix[i + 1][1] : NULL,
+                workspace);
+  for (size_t i = first; i <= last; i++)
+    for (size_t j = 1; j <= n; j++)
+      matrix[i][j] *= scale * scale;
+
+  free(workspace);
+  free(columns);
+
+  if (shared_args.log_level <= LOG_INFO)
+    printf("Thread %d finished \n", t_args->id);
+  // Terminate self
+  return NULL;
+}
+
+fft_plan *fft_plan_create(size_t length)
+{
+  fft_plan *plan = calloc(1, sizeof(fft_plan));
+  plan->length = length;
+
+  plan->twiddles = malloc(length * sizeof(double complex));
+  for (size_t k = 0; k < length; k++)
+    plan->twiddles[k] = cexp(-2 * M_PI * I * k / length);
+
+  /* Factorise the length, smallest radices first. Pairs of twos are merged
+  into fours, which have a cheaper butterfly. */
+  size_t remaining = length;
+  while (remaining % 4 == 0)
+  {
+    plan->factors[plan->num_factors++] = 4;
+    remaining /= 4;
+  }
+  for (size_t radix = 2; radix <= FFT_MAX_RADIX && remaining > 1; radix++)
+  {
+    while (remaining % radix == 0)
+    {
+      plan->factors[plan->num_factors++] = radix;
+      remaining /= radix;
+    }
+  }
+
+  if (remaining == 1)
+  {
+    plan->workspace_length = 0;
+    return plan;
+  }
+
+  /* Bluestein's algorithm rewrites the transform as a convolution with a
+  chirp, which is computed with power of two FFTs of at least
+  2 * length - 1 values. */
+  plan->num_factors = 0;
+  size_t convolution_length = 1;
+  while (convolution_length < 2 * length - 1)
+    convolution_length *= 2;
+  plan->convolution = fft_plan_create(convolution_length);
+
+  plan->chirp = malloc(length * sizeof(double complex));
+  for (size_t k = 0; k < length; k++)
+  {
+    // Reduce k^2 first to keep the angle accurate for long transforms.
+    size_t k_squared = (k * k) % (2 * length);
+    plan->chirp[k] = cexp(-M_PI * I * k_squared / length);
+  }
+
+  double complex *filter = calloc(convolution_length, sizeof(double complex));
+  filter[0] = conj(plan->chirp[0]);
+  for (size_t k = 1; k < length; k++)
+    filter[k] = filter[convolution_length - k] = conj(plan->chirp[k]);
+
+  plan->filter = malloc(convolution_length * sizeof(double complex));
+  fft_execute(plan->convolution, filter, plan->filter, NULL);
+  free(filter);
+
+  plan->workspace_length = 2 * convolution_length;
+  return plan;
+}
+
+void fft_plan_destroy(fft_plan *plan)
+{
+  if (plan->convolution != NULL)
+    fft_plan_destroy(plan->convolution);
+  free(plan->twiddles);
+  free(plan->chirp);
+  free(plan->filter);
+  free(plan);
+}
+
+/* Multiply two complex numbers. The * operator goes through a library call
+that takes care of infinities and NaNs, which would dominate the transform. */
+static inline double complex complex_multiply(double complex a,
+                                              double complex b)
+{
+  return CMPLX(creal(a) * creal(b) - cimag(a) * cimag(b),
+               creal(a) * cimag(b) + cimag(a) * creal(b));
+}
+
+/* Mixed radix decimation in time. Computes the FFT of the n values of in
+spaced stride apart into out, with factor pointing at the first radix still to
+apply. */
+static void fft_recurse(const fft_plan *plan, const double complex *in,
+                        double complex *out, size_t n, size_t stride,
+                        const size_t *factor)
+{
+  size_t radix = factor[0];
+  size_t m = n / radix;
+
+  // Transform each of the interleaved subsequences.
+  if (m == 1)
+  {
+    for (size_t q = 0; q < radix; q++)
+      out[q] = in[q * stride];
+  }
+  else
+  {
+    for (size_t q = 0; q < radix; q++)
+      fft_recurse(plan, in + q * stride, out + q * m, m, stride * radix,
+                  factor + 1);
+  }
+
+  // Combine them with a butterfly of the current radix.
+  double complex terms[FFT_MAX_RADIX];
+  for (size_t k = 0; k < m; k++)
+  {
+    terms[0] = out[k];
+    for (size_t q = 1; q < radix; q++)
+      terms[q] = complex_multiply(out[q * m + k],
+                                  plan->twiddles[q * k * stride]);
+
+    if (radix == 2)
+    {
+      out[k] = terms[0] + terms[1];
+      out[m + k] = terms[0] - terms[1];
+      continue;
+    }
+
+    if (radix == 4)
+    {
+      double complex even_sum = terms[0] + terms[2];
+      double complex even_difference = terms[0] - terms[2];
+      double complex odd_sum = terms[1] + terms[3];
+      // Multiplied by -i, the quarter turn of the forward transform.
+      double complex odd_difference = CMPLX(cimag(terms[1] - terms[3]),
+                                            -creal(terms[1] - terms[3]));
+      out[k] = even_sum + odd_sum;
+      out[m + k] = even_difference + odd_difference;
+      out[2 * m + k] = even_sum - odd_sum;
+      out[3 * m + k] = even_difference - odd_difference;
+      continue;
+    }
+
+    for (size_t u = 0; u < radix; u++)
+    {
+      double complex sum = terms[0];
+      for (size_t q = 1; q < radix; q++)
+        sum += complex_multiply(
+            terms[q], plan->twiddles[((q * u) % radix) * m * stride]);
+      out[u * m + k] = sum;
+    }
+  }
+}
+
+void fft_execute(const fft_plan *plan, const double complex *in,
+                 double complex *out, double complex *workspace)
+{
+  if (plan->length == 1)
+  {
+    out[0] = in[0];
+    return;
+  }
+
+  if (plan->convolution == NULL)
+  {
+    fft_recurse(plan, in, out, plan->length, 1, plan->factors);
+    return;
+  }
+
+  size_t length = plan->length;
+  size_t convolution_length = plan->convolution->length;
+  double complex *chirped = workspace;
+  double complex *transformed = workspace + convolution_length;
+
+  for (size_t k = 0; k < length; k++)
+    chirped[k] = complex_multiply(in[k], plan->chirp[k]);
+  for (size_t k = length; k < convolution_length; k++)
+    chirped[k] = 0;
+
+  fft_execute(plan->convolution, chirped, transformed, NULL);
+
+  // Multiply by the filter and invert by transforming the conjugate.
+  for (size_t k = 0; k < convolution_length; k++)
+    transformed[k] = conj(complex_multiply(transformed[k], plan->filter[k]));
+  fft_execute(plan->convolution, transformed, chirped, NULL);
+
+  for (size_t k = 0; k < length; k++)
+    out[k] = complex_multiply(conj(chirped[k]) / convolution_length,
+                              plan->chirp[k]);
+}
+
+void dst_execute(const fft_plan *plan, double *first, double *second,
+                 double complex *workspace)
+{
+  size_t length = plan->length;
+  size_t n = length / 2 - 1;
+  double complex *extended = workspace;
+  double complex *transformed = workspace + length;
+
+  /* The odd extension 0, x_1 .. x_n, 0, -x_n .. -x_1 of a real sequence has a
+  purely imaginary FFT whose values 1 .. n are -2i times its sine transform.
+  Putting the second sequence in the imaginary part turns its transform real,
+  so one FFT computes both. */
+  extended[0] = extended[n + 1] = 0;
+  for (size_t k = 0; k < n; k++)
+  {
+    double complex value = CMPLX(first[k], second == NULL ? 0 : second[k]);
+    extended[k + 1] = value;
+    extended[length - 1 - k] = -value;
+  }
+
+  fft_execute(plan, extended, transformed, workspace + 2 * length);
+
+  for (size_t k = 0; k < n; k++)
+  {
+    first[k] = -cimag(transformed[k + 1]) / 2;
+    if (second != NULL)
+      second[k] = creal(transformed[k + 1]) / 2;
   }
 }
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include <stdio.h>
 #include <math.h>
 #include <string.h>
+#include <getopt.h>
 
 enum log_level
 {
@@ -20,6 +21,10 @@ struct
     size_t size;
     double precision;
     enum log_level log_level;
+    // Number of grids used by nested iteration, including the finest one.
+    int levels;
+    // Number of sweeps taken by the last solve.
+    int iterations;
     double **matrix;
 } shared_args;
 
@@ -99,10 +104,60 @@ double **matrix_init()
     return result;
 }
 
+// Allocate an n x n matrix holding a copy of another one.
+double **matrix_copy(double **matrix)
+{
+    double **result = malloc(shared_args.size * sizeof(double *));
+    for (size_t i = 0; i < shared_args.size; i++)
+    {
+        result[i] = malloc(shared_args.size * sizeof(double));
+        memcpy(result[i], matrix[i], shared_args.size * sizeof(double));
+    }
+    return result;
+}
+
+// Free an n x n matrix.
+void matrix_free(double **matrix)
+{
+    for (size_t i = 0; i < shared_args.size; i++)
+    {
+        free(matrix[i]);
+    }
+    free(matrix);
+}
+
+/* Bilinearly interpolate one square matrix onto another of a different size,
+both covering the same unit square. Only the inner cells of the target are
+written when inner_only is set, leaving its boundary untouched. */
+void matrix_resample(double **source, size_t source_size,
+                     double **target, size_t target_size, bool inner_only)
+{
+    size_t first = inner_only ? 1 : 0;
+    size_t last = inner_only ? target_size - 2 : target_size - 1;
+    double scale = (double)(source_size - 1) / (target_size - 1);
+    for (size_t i = first; i <= last; i++)
+    {
+        double x = i * scale;
+        size_t i0 = x < source_size - 1 ? (size_t)x : source_size - 2;
+        double di = x - i0;
+        for (size_t j = first; j <= last; j++)
+        {
+            double y = j * scale;
+            size_t j0 = y < source_size - 1 ? (size_t)y : source_size - 2;
+            double dj = y - j0;
+            target[i][j] = (1 - di) * (1 - dj) * source[i0][j0] +
+                           (1 - di) * dj * source[i0][j0 + 1] +
+                           di * (1 - dj) * source[i0 + 1][j0] +
+                           di * dj * source[i0 + 1][j0 + 1];
+        }
+    }
+}
+
 // Use the relaxation technique to compute the average of a 2d array to a given precision
 double **serial_average_matrix(double **matrix)
 {
-    double **new_matrix = matrix_init();
+    // Boundary values are fixed, so the second matrix starts as a copy.
+    double **new_matrix = matrix_copy(matrix);
     bool still_changing = true;
     int iteration = 0;
     while (still_changing)
@@ -137,6 +192,7 @@ double **serial_average_matrix(double **matrix)
 
         iteration++;
     }
+    shared_args.iterations = iteration;
 
     // Free the new matrix
     for (int i = 0; i < shared_args.size; i++)
@@ -148,19 +204,108 @@ double **serial_average_matrix(double **matrix)
     return matrix;
 }
 
+/* Solve the problem on a hierarchy of grids, halving the size at each level.
+The solution on each coarse grid is interpolated onto the next finer one as its
+starting point, so the final Jacobi loop starts with the smooth error already
+removed. */
+double **nested_average_matrix(double **matrix)
+{
+    size_t fine_size = shared_args.size;
+    size_t sizes[64] = {fine_size};
+    int levels = 1;
+    // Every level needs at least one inner cell.
+    while (levels < shared_args.levels && (sizes[levels - 1] + 1) / 2 >= 3)
+    {
+        sizes[levels] = (sizes[levels - 1] + 1) / 2;
+        levels++;
+    }
+    shared_args.levels = levels;
+
+    double **coarse = NULL;
+    size_t coarse_size = 0;
+    for (int level = levels - 1; level > 0; level--)
+    {
+        shared_args.size = sizes[level];
+        if (shared_args.log_level <= LOG_DEBUG)
+            printf("Solving level %d of size %zu x %zu \n", level,
+                   sizes[level], sizes[level]);
+
+        // Sample the boundary and starting values of the original problem.
+        double **current = malloc(sizes[level] * sizeof(double *));
+        for (size_t i = 0; i < sizes[level]; i++)
+        {
+            current[i] = malloc(sizes[level] * sizeof(double));
+        }
+        matrix_resample(matrix, fine_size, current, sizes[level], false);
+
+        // Start from the solution of the coarser level
+        if (coarse != NULL)
+        {
+            matrix_resample(coarse, coarse_size, current, sizes[level], true);
+            shared_args.size = coarse_size;
+            matrix_free(coarse);
+            shared_args.size = sizes[level];
+        }
+
+        coarse = serial_average_matrix(current);
+        coarse_size = sizes[level];
+    }
+
+    if (coarse != NULL)
+    {
+        matrix_resample(coarse, coarse_size, matrix, fine_size, true);
+        shared_args.size = coarse_size;
+        matrix_free(coarse);
+    }
+
+    shared_args.size = fine_size;
+    return serial_average_matrix(matrix);
+}
+
 // Program Entry
 int main(int argc, char *argv[])
 {
+    const char *usage = "Usage: %s [--levels n] <size> <precision> [log_level] \n";
+    static struct option long_options[] = {
+        {"levels", required_argument, NULL, 'l'},
+        {NULL, 0, NULL, 0}};
+
+    shared_args.levels = 1;
+
+    // Parse options
+    int option;
+    while ((option = getopt_long(argc, argv, "", long_options, NULL)) != -1)
+    {
+        switch (option)
+        {
+        case 'l':
+            shared_args.levels = atoi(optarg);
+            if (shared_args.levels < 1)
+            {
+                fprintf(stderr, "Level count must be greater than 0\n");
+                return 1;
+            }
+            break;
+        default:
+            fprintf(stderr, usage, argv[0]);
+            return 1;
+        }
+    }
+
+    // Positional arguments follow the options
+    int num_args = argc - optind;
+    char **args = argv + optind;
+
     // Check for correct number of arguments
-    if (argc < 3 || argc > 4)
+    if (num_args < 2 || num_args > 3)
     {
-        fprintf(stderr, "Usage: %s <size> <precision> [log_level] \n", argv[0]);
+        fprintf(stderr, usage, argv[0]);
         return 1;
     }
 
-    if (argc == 4)
+    if (num_args == 3)
     {
-        shared_args.log_level = atoi(argv[3]);
+        shared_args.log_level = atoi(args[2]);
         if (shared_args.log_level < LOG_ALL || shared_args.log_level > LOG_NONE)
         {
             fprintf(stderr, "Invalid log level. Must be between %d and %d \n", LOG_ALL, LOG_NONE);
@@ -173,7 +318,7 @@ int main(int argc, char *argv[])
     }
 
     // Parse size
-    shared_args.size = atoi(argv[1]);
+    shared_args.size = atoi(args[0]);
     // Validate size
     if (shared_args.size < 2 || shared_args.size > 10e6)
     {
@@ -182,7 +327,7 @@ int main(int argc, char *argv[])
     }
 
     // Parse precision
-    shared_args.precision = atof(argv[2]);
+    shared_args.precision = atof(args[1]);
     // Validate precision
     if (shared_args.precision <= 0)
     {
@@ -191,9 +336,11 @@ int main(int argc, char *argv[])
     }
 
     double **a = matrix_init();
-    a = serial_average_matrix(a);
+    a = nested_average_matrix(a);
     if (shared_args.log_level <= LOG_INFO)
     {
+        printf("Converged after %d iterations using %d levels \n",
+               shared_args.iterations, shared_args.levels);
         print_matrix(a);
     }
 
@@ -2,7 +2,7 @@
 TIMEFORMAT=%R
 
 # Compile with gcc and all warnings
-# gcc -Wall -o average_parallel average_parallel.c -lpthread
+# gcc -Wall -o average_parallel average_parallel.c -lpthread -lm
 
 # Define array of matrix dimensions
 declare -a dim=( 8 16 32 64 128 256 512 1024 2048 4096 8192 )
@@ -1,5 +1,5 @@
 # Compile with gcc and all warnings
-gcc -Wall -o average_parallel average_parallel.c -lpthread
+gcc -Wall -o average_parallel average_parallel.c -lpthread -lm
 
 # Define array of matrix dimensions
 declare -a dim=(  73 179 283 419 547 661 811 947 1087 1229 1381 4073 )